@@ -0,0 +1,97 @@
+/*-------------------------------------------------------------------------------
+ *\file FF.hpp
+ *\info Header file for the calls into C libraries
+ * *----------------------------------------------------------------------------*/
+
+#ifndef FF_HEADER
+#define FF_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "LX.hpp"
+#include "UT.hpp"
+#include "ffi.h"
+
+namespace FF
+{
+
+/*------------------------------------------------------------------------------
+ *\TYPES
+ *-----------------------------------------------------------------------------*/
+
+// NOTE: Signatures with more params than this go through libffi
+constexpr size_t MAX_THUNK_ARGS = 6;
+
+// NOTE: Calls fn with args converted to its C types, returns the result as a
+// word. Pointer params and results are pointers, Void results are 0 and every
+// other type is a C int, like the cifs TL builds for ext defs.
+using Thunk = ssize_t (*)(void *fn, const ssize_t *args);
+
+struct Library;
+
+// NOTE: Ext structs larger than this can not be passed by value
+constexpr size_t MAX_STRUCT_SIZE = 64;
+
+// NOTE: The C layout of an ext struct, worked out once when the module loads
+// it. Thrax holds a struct as C_ints with one int per field, calls copy it to
+// and from the C layout at the cached offsets.
+struct Layout
+{
+  ffi_type      m_type; // NOTE: FFI_TYPE_STRUCT, with its size and alignment
+  LX::LangType *m_fields;
+  size_t       *m_offsets;
+  size_t        m_len;
+};
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+// NOTE: The libraries of the ext defs, shared by every module. A path is opened
+// once with every symbol bound eagerly, it stays loaded while anyone holds it
+// open and each symbol of it is looked up once.
+class Libraries
+{
+public:
+  static Library *open(UT::String path);
+
+  static void close(Library *library);
+
+  // NOTE: nullptr when the library has no such symbol
+  static void *find(Library *library, UT::String name);
+
+  // NOTE: Later opens of path load to instead, ie a headless stand-in for a
+  // library that needs a display
+  static void redirect(UT::String path, UT::String to);
+};
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+// NOTE: C_str, C_buf, C_ints and C_out args are all passed as the address the
+// word holds, the memory behind it is never copied
+bool is_pointer(LX::LangType type);
+
+// NOTE: params holds the arity non void params, nullptr if there is no thunk
+// for the signature
+Thunk thunk(const LX::LangType *params, size_t arity, LX::LangType result);
+
+// NOTE: nullptr unless every field is C_int, C_byte or C_float and the struct
+// fits in MAX_STRUCT_SIZE
+Layout *layout(const LX::LangType *fields, size_t len, AR::Arena &arena);
+
+// NOTE: A nullptr struct is all zeros
+void pack(const Layout &layout, const int *ints, void *c_struct);
+
+void unpack(const Layout &layout, const void *c_struct, int *ints);
+
+} // namespace FF
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // FF_HEADER
@@ -0,0 +1,125 @@
+/*-------------------------------------------------------------------------------
+ *\file JT.hpp
+ *\info Header file for the x86-64 jit of integer functions
+ * *----------------------------------------------------------------------------*/
+
+#ifndef JT_HEADER
+#define JT_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "RS.hpp"
+#include "UT.hpp"
+#include <vector>
+
+namespace JT
+{
+
+/*------------------------------------------------------------------------------
+ *\TYPES
+ *-----------------------------------------------------------------------------*/
+
+// NOTE: Native code follows the SysV ABI, so params past the sixth would
+// have to go through the stack
+constexpr uint32_t MAX_ARITY = 6;
+
+// NOTE: How a call of native code went, see try_call
+enum class Native
+{
+  Done,
+  Skipped,    // NOTE: there is no native code for the call, or an arg is no int
+  Overflowed, // NOTE: the native code ran out of stack
+};
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+// NOTE: Compiles functions whose body only does integer arithmetic,
+// branches, lets and calls to itself. Everything else is left to the
+// interpreters, which stay the source of truth.
+class Jit
+{
+public:
+  Jit();
+  ~Jit();
+
+  Jit(const Jit &)            = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // NOTE: self is the global slot the function is defined in, calls through
+  // it become direct native calls
+  bool compile(RS::Value value, uint32_t self);
+
+private:
+  struct Page
+  {
+    void  *m_mem;
+    size_t m_len;
+  };
+
+  std::vector<Page>    m_pages;
+  std::vector<uint8_t> m_code;
+  std::vector<size_t>  m_self_calls; // NOTE: offsets of rel32 to patch
+  const RS::Proto     *m_proto;
+  uint32_t             m_self;
+  size_t               m_entry; // NOTE: first instruction past the prologue
+  int32_t              m_depth; // NOTE: values pushed on the native stack
+  bool                 m_ok;
+
+  void emit(std::initializer_list<uint8_t> bytes);
+
+  void emit_u32(uint32_t word);
+
+  void emit_u64(uint64_t word);
+
+  size_t emit_jump(std::initializer_list<uint8_t> opcode);
+
+  void patch(size_t at);
+
+  void load(uint32_t slot);
+
+  void store(uint32_t slot, uint8_t reg);
+
+  void lower(const RS::Node *node, bool tail = false);
+
+  void *install();
+};
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+// NOTE: Fails if the native stack ran out, nothing is jitted that could have
+// side effects, so the call can be redone by an interpreter
+bool call(const void *code, const ssize_t *args, uint32_t argc, ssize_t &result);
+
+inline Native
+try_call(
+  const RS::Proto &proto, const RS::Value *args, size_t argc, RS::Value &result)
+{
+  if (!proto.m_native || argc != proto.m_arity) return Native::Skipped;
+
+  ssize_t words[MAX_ARITY];
+  for (size_t i = 0; i < argc; ++i)
+  {
+    if (RS::Kind::Int != args[i].m_kind) return Native::Skipped;
+    words[i] = args[i].as.m_int;
+  }
+
+  ssize_t word = 0;
+  if (!call(proto.m_native, words, argc, word)) return Native::Overflowed;
+
+  result = RS::Value{ word };
+  return Native::Done;
+}
+
+} // namespace JT
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // JT_HEADER
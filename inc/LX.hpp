@@ -11,6 +11,7 @@
  *-----------------------------------------------------------------------------*/
 
 #include "UT.hpp"
+#include <vector>
 
 /*------------------------------------------------------------------------------
  *\MACROS
@@ -74,6 +75,7 @@ constexpr UT::String INT{ "int" };
 constexpr UT::String PUB{ "pub" };
 constexpr UT::String WHILE{ "while" };
 constexpr UT::String EXT{ "ext" };
+constexpr UT::String STRUCT{ "struct" };
 
 } // namespace Keyword
 
@@ -94,6 +96,11 @@ constexpr UT::String EXT{ "ext" };
   X(Int32)                                                                     \
   X(Int64)                                                                     \
   X(Ptr)                                                                       \
+  X(Buf)                                                                       \
+  X(Ints)                                                                      \
+  X(Out)                                                                       \
+  X(Float)                                                                     \
+  X(Struct)                                                                    \
   X(Void)
 
 enum class LangType
@@ -114,7 +121,8 @@ enum class LangType
   X(ELSE_KEYWORD)                                                              \
   X(IN_KEYWORD)                                                                \
   X(CONTROL_STRUCTURE_ERROR)                                                   \
-  X(WORD_NOT_FOUND)
+  X(WORD_NOT_FOUND)                                                            \
+  X(GROUP_END)
 
 enum class E
 {
@@ -143,6 +151,7 @@ enum class E
   X(Str)                                                                       \
   X(While)                                                                     \
   X(ExtDef)                                                                    \
+  X(StructDef)                                                                 \
   X(Max)
 
 enum class Type
@@ -152,6 +161,26 @@ enum class Type
 #undef X
 };
 
+// NOTE: The runs the lexer skips over, a scan stops at the first byte that is
+// not part of the run and always at NUL
+enum class Scan
+{
+  WhiteSpace, // NOTE: ' ', '\t' and '\n'
+  Word,       // NOTE: up to a byte that delimits a word
+  Name,       // NOTE: up to a byte that delimits a word, '#' or '"'
+  Line,       // NOTE: up to '\n'
+  Quote,      // NOTE: up to '"'
+};
+
+// NOTE: The lexer scans with the widest kernel the CPU has, the others only
+// run in the tests
+enum class ScanKernel
+{
+  Scalar,
+  SSSE3,
+  AVX2,
+};
+
 struct Token;
 using Tokens = UT::Vec<Token>;
 
@@ -200,9 +229,11 @@ struct Sig
   union
   {
     UT::Pair<Sig> pair;
+    UT::Sym       name; // NOTE: of the ext struct a Struct sig is
   } as;
 };
 
+// NOTE: A StructDef keeps its fields in sig, one after the other like params
 struct ExtSym
 {
   UT::String name;
@@ -270,6 +301,10 @@ public:
   size_t      m_begin;
   size_t      m_end;
 
+  // NOTE: Offsets of the keywords that begin the top level defs, see index_defs
+  std::vector<size_t> m_def_offsets;
+  bool                m_indexed = false;
+
   Lexer(const char *const input, AR::Arena &arena, size_t begin, size_t end);
 
   Lexer(Lexer const &l);
@@ -286,8 +321,11 @@ public:
 
   void subsume_sub_lexer(Lexer &l);
 
-  LX::E find_matching_paren(size_t &paren_match_idx);
+  // NOTE: One pass over the input that finds every int, pub and ext keyword
+  // outside of comments and strings
+  void index_defs();
 
+  // NOTE: idx is the offset of the next def after the cursor
   LX::E find_next_global_symbol(size_t &idx);
 
   char next_char();
@@ -298,7 +336,8 @@ public:
 
   void push_operator(char c);
 
-  void push_group(Lexer l);
+  // NOTE: false if this lexer has no group open
+  bool close_group(std::vector<size_t> &groups);
 
   E match_operator(char c);
 
@@ -317,6 +356,12 @@ public:
   E operator()();
 };
 
+bool has_scan_kernel(ScanKernel kernel);
+
+// NOTE: The offset of the byte the run of scan that begins at idx stops at,
+// found by kernel, which the CPU has to have
+size_t scan_with(ScanKernel kernel, Scan scan, const char *input, size_t idx);
+
 } // namespace LX
 
 /*-------------------------------------------------------------------------------
@@ -498,6 +543,13 @@ to_string(
     return "ext " + to_string(ext_sym.name) + ": " + to_string(ext_sym.sig)
            + " = " + to_string(ext_sym.def);
   }
+  case LX::Type::StructDef:
+  {
+    auto ext_sym = t.as.ext_sym;
+
+    return "ext " + to_string(ext_sym.name) + ": struct "
+           + to_string(ext_sym.sig);
+  }
   }
   UT_FAIL_IF("UNREACHABLE");
   return "";
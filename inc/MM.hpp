@@ -0,0 +1,132 @@
+/*-------------------------------------------------------------------------------
+ *\file MM.hpp
+ *\info Header file for the purity analysis and the memo table
+ * *----------------------------------------------------------------------------*/
+
+#ifndef MM_HEADER
+#define MM_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "EX.hpp"
+#include "UT.hpp"
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace MM
+{
+
+/*------------------------------------------------------------------------------
+ *\TYPES
+ *-----------------------------------------------------------------------------*/
+
+// NOTE: Calls with more args than this are never cached
+constexpr size_t MAX_ARGS = 8;
+
+struct Stats
+{
+  size_t m_hits      = 0;
+  size_t m_misses    = 0;
+  size_t m_evictions = 0;
+};
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+// NOTE: A def is pure if evaluating it can not call into C, loop or produce a
+// string, and every def it calls is pure as well. Calls through params or
+// lets (higher order calls) are not known, so they are not pure.
+class Purity
+{
+public:
+  bool analyse(UT::String name, const EX::Expr &expr);
+
+  bool is_pure(UT::String name) const;
+
+private:
+  std::map<UT::Sym, bool> m_pure;
+
+  bool pure(const EX::Expr         &expr,
+            std::vector<UT::String> &bound,
+            UT::String               self);
+
+  bool pure_exprs(const EX::Exprs         &exprs,
+                  std::vector<UT::String> &bound,
+                  UT::String               self);
+
+  bool pure_global(UT::String name, UT::String self);
+};
+
+// NOTE: Results of pure calls keyed on the function and its integer args. Once
+// m_limit entries are cached the least recently used one is evicted.
+class Memo
+{
+public:
+  size_t m_limit;
+  Stats  m_stats;
+
+  Memo(size_t limit);
+
+  bool find(const void *fn, const ssize_t *args, size_t argc, ssize_t &result);
+
+  void insert(const void *fn, const ssize_t *args, size_t argc, ssize_t result);
+
+private:
+  struct Key
+  {
+    const void *m_fn;
+    size_t      m_argc;
+    ssize_t     m_args[MAX_ARGS];
+
+    bool operator==(const Key &other) const;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key &key) const;
+  };
+
+  using Entry = std::pair<Key, ssize_t>;
+
+  std::list<Entry> m_entries; // NOTE: most recently used first
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+  static Key make_key(const void *fn, const ssize_t *args, size_t argc);
+};
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+// NOTE: Caching a call that is made in tail position would keep the caller
+// frame alive, so defs that loop through self tail calls are not memoized
+bool calls_self_in_tail(UT::String name, const EX::Expr &expr);
+
+} // namespace MM
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+namespace std
+{
+inline string
+to_string(
+  MM::Stats stats)
+{
+  return "hits = " + to_string(stats.m_hits)
+         + ", misses = " + to_string(stats.m_misses)
+         + ", evictions = " + to_string(stats.m_evictions);
+}
+} // namespace std
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // MM_HEADER
@@ -0,0 +1,59 @@
+/*-------------------------------------------------------------------------------
+ *\file OP.hpp
+ *\info Header file for the constant folding pass
+ * *----------------------------------------------------------------------------*/
+
+#ifndef OP_HEADER
+#define OP_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "EX.hpp"
+#include "UT.hpp"
+#include <map>
+#include <vector>
+
+namespace OP
+{
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+// NOTE: Runs on each def between the parser and the evaluation. Constant
+// arithmetic is folded, ifs with a known condition are pruned and defs that
+// fold to an integer and are defined only once are propagated into the defs
+// that come after them.
+class Folder
+{
+public:
+  // NOTE: Every def of the module has to be declared before the first run
+  void declare(UT::String name);
+
+  // NOTE: Rewrites expr in place, returns how many nodes were removed
+  size_t run(UT::String name, EX::Expr &expr);
+
+private:
+  std::map<UT::Sym, size_t>  m_defined;
+  std::map<UT::Sym, ssize_t> m_constants;
+
+  void fold(EX::Expr &expr, std::vector<UT::String> &bound);
+
+  void fold_exprs(EX::Exprs &exprs, std::vector<UT::String> &bound);
+};
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+size_t count_nodes(const EX::Expr &expr);
+
+} // namespace OP
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // OP_HEADER
@@ -0,0 +1,147 @@
+/*-------------------------------------------------------------------------------
+ *\file PL.hpp
+ *\info Header file for the dependency graph and its worker pool
+ * *----------------------------------------------------------------------------*/
+
+#ifndef PL_HEADER
+#define PL_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "UT.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PL
+{
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+// NOTE: Tasks are numbered in the order they are added and can only depend on
+// tasks added before them, so running them in that order is always valid
+class Graph
+{
+public:
+  using Task = std::function<void(size_t task, size_t worker)>;
+
+  size_t add();
+
+  void depend(size_t task, size_t on);
+
+  size_t size() const;
+
+  // NOTE: Runs every task once the tasks it depends on are done. The calling
+  // thread is worker 0, the others are started for the run and joined after.
+  void run(size_t workers, const Task &task);
+
+private:
+  std::vector<std::vector<size_t>> m_dependents;
+  std::vector<size_t>              m_blockers; // NOTE: deps not done yet
+};
+
+// NOTE: Fork-join on a fixed set of threads. Every worker keeps the tasks it
+// forked in a deque, it takes the newest one back itself if nobody stole it,
+// while idle workers steal the oldest one of any deque.
+class Pool
+{
+public:
+  using Fn = std::function<void()>;
+
+  Pool(size_t workers);
+  ~Pool();
+
+  Pool(const Pool &)            = delete;
+  Pool &operator=(const Pool &) = delete;
+
+  // NOTE: Runs left on this thread and right on whichever worker gets to it
+  // first, returns once both are done. Threads that are not workers of the
+  // pool use the deque of worker 0, so only one of them may fork at a time.
+  void fork_join(const Fn &left, const Fn &right);
+
+private:
+  struct Task
+  {
+    const Fn         *m_fn;
+    std::atomic<bool> m_done;
+  };
+
+  struct Deque
+  {
+    std::mutex         m_mutex;
+    std::deque<Task *> m_tasks;
+  };
+
+  std::vector<std::unique_ptr<Deque>> m_deques;
+  std::vector<std::thread>            m_threads;
+  std::atomic<bool>                   m_stop;
+  std::atomic<size_t>                 m_queued;
+  std::mutex                          m_idle_mutex;
+  std::condition_variable             m_idle;
+
+  Task *steal(size_t worker);
+
+  void work(size_t worker);
+};
+
+// NOTE: Runs jobs on threads of its own in the order they were posted, while
+// the thread that posted them goes on. Tickets count up from 0 in that order.
+class Jobs
+{
+public:
+  using Job = std::function<ssize_t()>;
+
+  Jobs(size_t workers);
+  ~Jobs(); // NOTE: runs the jobs that are still queued first
+
+  Jobs(const Jobs &)            = delete;
+  Jobs &operator=(const Jobs &) = delete;
+
+  size_t post(Job job);
+
+  // NOTE: Blocks until the job of ticket is done, its result can be waited on
+  // any number of times
+  ssize_t wait(size_t ticket);
+
+private:
+  struct Slot
+  {
+    Job     m_job;
+    ssize_t m_result;
+    bool    m_done;
+  };
+
+  std::deque<Slot>         m_slots;
+  size_t                   m_next; // NOTE: the first job nobody took yet
+  bool                     m_stop;
+  std::mutex               m_mutex;
+  std::condition_variable  m_posted;
+  std::condition_variable  m_finished;
+  std::vector<std::thread> m_threads;
+
+  void work();
+};
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+// NOTE: 0 asks for one worker per core
+size_t workers(size_t wanted);
+
+} // namespace PL
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // PL_HEADER
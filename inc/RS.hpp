@@ -0,0 +1,347 @@
+/*-------------------------------------------------------------------------------
+ *\file RS.hpp
+ *\info Header file for the resolver and the frame runtime
+ * *----------------------------------------------------------------------------*/
+
+#ifndef RS_HEADER
+#define RS_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "EX.hpp"
+#include "TL.hpp"
+#include "UT.hpp"
+#include <unordered_map>
+#include <vector>
+
+namespace VM
+{
+struct Chunk;
+} // namespace VM
+
+namespace MM
+{
+class Memo;
+} // namespace MM
+
+namespace RS
+{
+
+/*------------------------------------------------------------------------------
+ *\TYPES
+ *-----------------------------------------------------------------------------*/
+
+#define RS_Op_EnumVariants                                                     \
+  X(Int)                                                                       \
+  X(Str)                                                                       \
+  X(Local)                                                                     \
+  X(Global)                                                                    \
+  X(Lambda)                                                                    \
+  X(Call)                                                                      \
+  X(ForeignCall)                                                               \
+  X(Add)                                                                       \
+  X(Sub)                                                                       \
+  X(Mult)                                                                      \
+  X(Div)                                                                       \
+  X(Modulus)                                                                   \
+  X(IsEq)                                                                      \
+  X(Minus)                                                                     \
+  X(Not)                                                                       \
+  X(If)                                                                        \
+  X(Let)                                                                       \
+  X(While)
+
+enum class Op
+{
+#define X(X_enum) X_enum,
+  RS_Op_EnumVariants
+#undef X
+};
+
+#define RS_Kind_EnumVariants                                                   \
+  X(Int)                                                                       \
+  X(Str)                                                                       \
+  X(Fn)
+
+enum class Kind
+{
+#define X(X_enum) X_enum,
+  RS_Kind_EnumVariants
+#undef X
+};
+
+struct Node;
+struct Proto;
+struct Frame;
+
+// NOTE: A variable is addressed by how many function frames have to be
+// crossed (depth) and its index inside of that frame (slot)
+struct Address
+{
+  uint32_t m_depth;
+  uint32_t m_slot;
+};
+
+struct Closure
+{
+  const Proto *m_proto;
+  Frame       *m_env;
+  Frame       *m_partial; // NOTE: holds the already applied params, if any
+};
+
+struct Value
+{
+  Kind m_kind;
+  union
+  {
+    ssize_t    m_int = 0;
+    UT::String m_string;
+    Closure    m_fn;
+  } as;
+
+  Value() = default;
+  Value(ssize_t integer);
+  Value(UT::String string);
+  Value(Closure fn);
+};
+
+struct Frame
+{
+  Frame   *m_parent;
+  uint32_t m_len;
+  uint32_t m_bound;    // NOTE: only used by partial applications
+  bool     m_captured; // NOTE: captured frames are never recycled
+  Value   *m_slots;    // NOTE: points right past the frame header
+};
+
+struct Call
+{
+  Node    *m_callee;
+  Node   **m_args;
+  uint32_t m_argc;
+};
+
+struct ForeignCall
+{
+  TL::DFN *m_fn;
+  Node   **m_args;
+  uint32_t m_argc;
+};
+
+struct BinOp
+{
+  Node *m_left;
+  Node *m_right;
+};
+
+struct If
+{
+  Node *m_condition;
+  Node *m_true_branch;
+  Node *m_else_branch;
+};
+
+struct Let
+{
+  Address m_target;
+  Node   *m_value;
+  Node   *m_continuation;
+};
+
+// NOTE: A loop works on copies of the variables it rebinds, the copies are
+// made from m_carried_from into m_carried_to before the first iteration
+struct While
+{
+  Node     *m_condition;
+  Node     *m_body;
+  Address  *m_carried_from;
+  uint32_t *m_carried_to;
+  uint32_t  m_carried_len;
+};
+
+struct Node
+{
+  Op m_op;
+  union
+  {
+    ssize_t     m_int = 0;
+    UT::String  m_string;
+    Address     m_local;
+    uint32_t    m_global;
+    Proto      *m_proto;
+    Call        m_call;
+    ForeignCall m_foreign;
+    BinOp       m_bin;
+    Node       *m_operand;
+    If          m_if;
+    Let         m_let;
+    While       m_while;
+  } as;
+
+  Node() = default;
+  Node(Op op)
+      : m_op{ op } {};
+};
+
+// NOTE: A chain of directly nested lambdas (\x = \y = ...) is one proto
+// with an arity equal to the length of the chain
+struct Proto
+{
+  UT::String m_name;
+  uint32_t   m_arity;
+  uint32_t   m_frame_len;
+  bool       m_captures; // NOTE: the body refers to an enclosing frame
+  Node      *m_body;
+  EX::FnDef  m_source;
+  mutable VM::Chunk *m_chunk;        // NOTE: filled by the VM when first run
+  mutable bool       m_uncompilable; // NOTE: left to the frame runtime
+  mutable const void *m_native;      // NOTE: filled by the jit, if it can
+  mutable bool        m_memo;        // NOTE: pure, results can be cached
+};
+
+struct Globals
+{
+  std::vector<UT::String> m_names;
+  std::vector<Value>      m_values;
+  std::vector<uint8_t>    m_defined; // NOTE: not bool, slots are set by threads
+
+  // NOTE: Slot of each name, by its interned symbol
+  std::unordered_map<UT::Sym, uint32_t> m_slots;
+
+  uint32_t slot(UT::String name);
+
+  bool find(UT::String name, uint32_t &slot);
+
+  void define(UT::String name, Value value);
+};
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+class Resolver
+{
+public:
+  AR::Arena &m_arena;
+  Globals   &m_globals;
+
+  Resolver(AR::Arena &arena, Globals &globals);
+
+  Proto *resolve_def(const EX::Expr &expr, UT::String name);
+
+private:
+  struct Binding
+  {
+    UT::String m_name;
+    uint32_t   m_slot;
+  };
+
+  struct Scope
+  {
+    Scope               *m_parent;
+    std::vector<Binding> m_bindings;
+    uint32_t             m_len;
+    bool                 m_captures;
+  };
+
+  bool lookup(Scope &scope, UT::String name, Address &address);
+
+  Node *resolve(const EX::Expr &expr, Scope &scope, bool spine);
+
+  Node *resolve_var(UT::String name, Scope &scope);
+
+  Node *resolve_app(UT::String name, const EX::Exprs &params, Scope &scope);
+
+  Node **resolve_args(const EX::Exprs &params, Scope &scope);
+
+  Proto *resolve_fn(const EX::FnDef &fn, Scope *parent);
+};
+
+class Runtime
+{
+public:
+  AR::Arena &m_arena;
+  Globals   &m_globals;
+  MM::Memo  *m_memo; // NOTE: only set when memoization is enabled
+
+  Runtime(AR::Arena &arena, Globals &globals);
+
+  Value run(const Proto &def);
+
+  Value apply(Value fn, Value *args, size_t argc);
+
+  Value eval(const Node *node, Frame *frame);
+
+private:
+  static constexpr size_t POOL_CLASSES = 32;
+
+  std::vector<Frame *> m_pool[POOL_CLASSES];
+
+  Frame *acquire(uint32_t len, Frame *parent);
+
+  void release(Frame *frame);
+
+  Value *lookup(Address address, Frame *frame);
+
+  bool memo_call(const Proto &proto, Frame *frame, Value &result);
+
+  ssize_t eval_int(const Node *node, Frame *frame);
+};
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+EX::Expr to_expr(Value value);
+
+Value eval(const EX::Expr &expr, AR::Arena &arena);
+
+} // namespace RS
+
+namespace std
+{
+inline string
+to_string(
+  RS::Op op)
+{
+  switch (op)
+  {
+#define X(X_enum)                                                              \
+  case RS::Op::X_enum: return #X_enum;
+    RS_Op_EnumVariants
+#undef X
+  }
+  UT_FAIL_IF("UNREACHABLE");
+  return "";
+}
+
+inline string
+to_string(
+  RS::Kind kind)
+{
+  switch (kind)
+  {
+#define X(X_enum)                                                              \
+  case RS::Kind::X_enum: return #X_enum;
+    RS_Kind_EnumVariants
+#undef X
+  }
+  UT_FAIL_IF("UNREACHABLE");
+  return "";
+}
+
+inline string
+to_string(
+  RS::Value value)
+{
+  return to_string(RS::to_expr(value));
+}
+} // namespace std
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // RS_HEADER
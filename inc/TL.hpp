@@ -11,13 +11,16 @@
  *-----------------------------------------------------------------------------*/
 
 #include "EX.hpp"
+#include "MM.hpp"
 #include "UT.hpp"
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace TL
 {
 
-using Env = std::map<std::string, EX::Expr>;
+using Env = std::map<UT::Sym, EX::Expr>;
 
 struct Instance
 {
@@ -37,22 +40,89 @@ enum class Type
 #undef X
 };
 
+#define TL_EngineEnumVariants                                                  \
+  X(Reference)                                                                 \
+  X(Frames)                                                                    \
+  X(VM)
+
+// NOTE: Reference walks EX::Expr with a copied Env, it is kept so that the
+// results of the other engines can be compared against it
+enum class Engine
+{
+#define X(enum) enum,
+  TL_EngineEnumVariants
+#undef X
+};
+
+struct Options
+{
+  Engine m_engine = Engine::Frames;
+  bool   m_jit    = true; // NOTE: compile integer functions to native code
+  size_t m_memo_limit = 0; // NOTE: cached results of pure fns, 0 is off
+  bool   m_fold       = true; // NOTE: run the constant folding pass
+  size_t m_max_frames = 1 << 22; // NOTE: calls the VM can nest
+  size_t m_workers    = 0; // NOTE: threads reading and running defs, 0 is one
+                           // per core
+  size_t m_fork_depth = 0; // NOTE: forks Reference can nest, 0 is off
+};
+
 struct Def
 {
   Type       m_type;
   UT::String m_name;
   EX::Expr   m_expr;
+  size_t     m_folded; // NOTE: nodes removed by the constant folding pass
 };
 
 struct Mod
 {
   UT::String   m_name;
   UT::Vec<Def> m_defs;
+  MM::Stats    m_memo;
+  MM::Stats    m_ext_cache; // NOTE: calls of pure and frame_stable ext defs
 
-  Mod(UT::String file_name, AR::Arena &arena);
+  // NOTE: Hold the defs that were lexed and parsed on other threads
+  std::vector<std::unique_ptr<AR::Arena>> m_arenas;
+
+  Mod(UT::String file_name, AR::Arena &arena, Options options = {});
 };
 
+class DFN;
+
 Instance eval(Instance &inst);
+
+DFN *find_foreign(UT::String name);
+
+// NOTE: Ext defs take at most this many args, so that calls can keep their args
+// on the stack
+constexpr size_t MAX_FOREIGN_ARGS = 16;
+
+// NOTE: Does not allocate. Args past the arity are dropped, missing ones are
+// passed as 0.
+ssize_t call_foreign(DFN *foreign_fn, const ssize_t *args, size_t argc);
+
+// NOTE: Fails for a call site that passes more than MAX_FOREIGN_ARGS args, so
+// that the engines can keep the args of every call on the stack
+void check_foreign_args(DFN *foreign_fn, size_t argc);
+
+// NOTE: Results of frame_stable ext defs are reused until the frame changes.
+// Every engine starts a frame before it checks the condition of a while, and
+// before each def.
+void next_frame();
+
+// NOTE: Buffers for the C_buf, C_ints and C_out params of ext defs, bound from
+// the program like any C fn, ie ("thrax_ints" ""). They are zeroed and owned by
+// the module that asks for them, C gets their address and nothing is copied.
+extern "C" void *thrax_buffer(int len);
+extern "C" int  *thrax_ints(int len);
+extern "C" int   thrax_get(const int *ints, int idx);
+extern "C" void  thrax_set(int *ints, int idx, int value);
+
+// NOTE: Calls of async ext defs return a handle at once and run on threads of
+// the module. Waiting on the handle gives the result of the call, bound with the
+// result type of the def, ie await: C_int -> C_int = ("thrax_await" ""). The
+// memory a call takes must be left alone until it is waited on.
+extern "C" ssize_t thrax_await(int handle);
 } // namespace TL
 
 namespace std
@@ -71,6 +141,20 @@ to_string(
   UT_FAIL_IF("UNREACHABLE");
 }
 
+inline string
+to_string(
+  TL::Engine engine)
+{
+  switch (engine)
+  {
+#define X(X_enum)                                                              \
+  case TL::Engine::X_enum: return #X_enum;
+    TL_EngineEnumVariants
+#undef X
+  }
+  UT_FAIL_IF("UNREACHABLE");
+}
+
 } // namespace std
 
 #endif // TL_HEADER
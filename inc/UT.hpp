@@ -7,8 +7,13 @@
 #include <cstdlib>
 #include <cstring>
 #include <initializer_list>
+#include <mutex>
+#include <pthread.h>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 // TODO: There should be a special format for macro args
 // This is because arguments can resolve to other macros
@@ -107,6 +112,14 @@ public:
     return alloc(sizeof(t));
   }
 
+  // NOTE: Each block took one heap allocation, and so did each time the list
+  // of blocks was grown
+  size_t
+  blocks() const
+  {
+    return this->len;
+  }
+
   Arena();
   ~Arena();
 
@@ -235,6 +248,7 @@ fail_if(
   {
     std::printf("[%s] %s : %s\n", prefix, file, fn_name);
     std::printf("  %d | \033[1;37m%s\033[0m\n", line, msg);
+    std::fflush(stdout);
     UT::IMPL::abort();
   }
 }
@@ -333,23 +347,30 @@ template <typename O> struct Vu
   };
 };
 
+// NOTE: Identifiers coming out of the lexer are interned, m_sym is their
+// symbol id. It is 0 otherwise.
 struct String : public Vu<char>
 {
+  uint32_t m_sym;
+
   template <size_t N>
   constexpr String(
     const char (&mem)[N])
-      : Vu<char>{ mem, N - 1 }
+      : Vu<char>{ mem, N - 1 },
+        m_sym{ 0 }
   {
   }
   // Construct from pointer + length
   String(
     const char *mem, size_t len)
-      : Vu<char>{ (char *)mem, len }
+      : Vu<char>{ (char *)mem, len },
+        m_sym{ 0 }
   {
   }
   String(
     char *mem, size_t len)
-      : Vu<char>{ mem, len }
+      : Vu<char>{ mem, len },
+        m_sym{ 0 }
   {
   }
 
@@ -459,6 +480,7 @@ inline bool
 strcompare(
   const String s1, const String s2)
 {
+  if (s1.m_sym && s2.m_sym) return s1.m_sym == s2.m_sym;
   return s1.m_len == s2.m_len && 0 == std::memcmp(s1.m_mem, s2.m_mem, s1.m_len);
 }
 
@@ -473,6 +495,187 @@ strdup(
   return result;
 }
 
+/*------------------------------------------------------------------------------
+ *\SYMBOLS
+ *-----------------------------------------------------------------------------*/
+
+using Sym = uint32_t;
+
+// NOTE: FNV-1a
+inline uint32_t
+hash(
+  const char *mem, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; ++i)
+  {
+    hash ^= (uint8_t)mem[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// NOTE: The table lives for the whole process, so that symbol ids are the same
+// for every module. Interned names are NUL terminated. Any thread may intern,
+// each one remembers the names it has seen and only locks the table for names
+// that are new to it.
+class Symbols
+{
+public:
+  static String
+  intern(
+    String s)
+  {
+    if (s.m_sym) return s;
+
+    thread_local std::unordered_map<Key, String, KeyHash> seen{};
+
+    uint32_t hash = UT::hash(s.m_mem, s.m_len);
+    Key      key{ std::string_view{ s.m_mem, s.m_len }, hash };
+    auto     hit = seen.find(key);
+    if (seen.end() != hit) return hit->second;
+
+    String name = intern_shared(key);
+    seen.emplace(Key{ std::string_view{ name.m_mem, name.m_len }, key.m_hash },
+                 name);
+    return name;
+  }
+
+  static String
+  name(
+    Sym sym)
+  {
+    Table                      &table = get();
+    std::lock_guard<std::mutex> lock{ table.m_mutex };
+    return table.m_names[sym];
+  }
+
+private:
+  // NOTE: The bytes of a name and their hash, which is computed once when a
+  // name is interned and used by both the table and the cache of each thread
+  struct Key
+  {
+    std::string_view m_bytes;
+    uint32_t         m_hash;
+
+    bool
+    operator==(
+      const Key &other) const
+    {
+      return this->m_hash == other.m_hash && this->m_bytes == other.m_bytes;
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t
+    operator()(
+      const Key &key) const
+    {
+      return key.m_hash;
+    }
+  };
+
+  struct Table
+  {
+    std::mutex                             m_mutex;
+    AR::Arena                              m_arena;
+    std::vector<String>                    m_names; // NOTE: 0 is no symbol
+    std::unordered_map<Key, Sym, KeyHash> m_index;
+
+    Table()
+        : m_mutex{},
+          m_arena{},
+          m_names{ String{ (char *)nullptr, 0 } },
+          m_index{}
+    {
+    }
+  };
+
+  static Table &
+  get()
+  {
+    static Table table{};
+    return table;
+  }
+
+  static String
+  intern_shared(
+    Key key)
+  {
+    Table                      &table = get();
+    std::lock_guard<std::mutex> lock{ table.m_mutex };
+
+    auto it = table.m_index.find(key);
+    if (table.m_index.end() != it) return table.m_names[it->second];
+
+    String name = UT::strdup(
+      table.m_arena, String{ key.m_bytes.data(), key.m_bytes.size() });
+    name.m_sym = table.m_names.size();
+
+    table.m_names.push_back(name);
+    table.m_index[Key{ std::string_view{ name.m_mem, name.m_len }, key.m_hash }]
+      = name.m_sym;
+
+    return name;
+  }
+};
+
+inline String
+intern(
+  String s)
+{
+  return Symbols::intern(s);
+}
+
+inline Sym
+symbol(
+  String s)
+{
+  return s.m_sym ? s.m_sym : Symbols::intern(s).m_sym;
+}
+
+/*------------------------------------------------------------------------------
+ *\STACK
+ *-----------------------------------------------------------------------------*/
+
+// NOTE: Bytes at the bottom of the native stack that are kept for reporting
+// the error once the interpreters run out of stack
+constexpr size_t STACK_RESERVE = 1 << 16;
+
+namespace IMPL
+{
+// NOTE: initial-exec, so that jitted code can read it at a fixed offset of fs
+inline thread_local uintptr_t stack_floor
+  __attribute__((tls_model("initial-exec")))
+  = 0;
+} // namespace IMPL
+
+// NOTE: Lowest address the native stack of this thread may grow down to
+inline uintptr_t
+stack_floor()
+{
+  if (!IMPL::stack_floor)
+  {
+    pthread_attr_t attr;
+    void          *stack     = nullptr;
+    size_t         stack_len = 0;
+    if (0 == pthread_getattr_np(pthread_self(), &attr))
+    {
+      pthread_attr_getstack(&attr, &stack, &stack_len);
+      pthread_attr_destroy(&attr);
+    }
+    IMPL::stack_floor = (uintptr_t)stack + STACK_RESERVE;
+  }
+  return IMPL::stack_floor;
+}
+
+inline bool
+stack_exhausted()
+{
+  return (uintptr_t)__builtin_frame_address(0) < stack_floor();
+}
+
 template <typename O> struct Vec
 {
   O         *m_mem;
@@ -850,12 +1053,7 @@ inline string
 to_string(
   UT::String s)
 {
-  const char *var_mem = new char[s.m_len + 1];
-  memset((void *)var_mem, 0, s.m_len + 1);
-  memcpy((void *)var_mem, s.begin(), s.m_len);
-  string result{ var_mem };
-  delete[] var_mem;
-  return result;
+  return string{ s.begin(), strnlen(s.begin(), s.m_len) };
 }
 } // namespace std
 
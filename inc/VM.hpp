@@ -0,0 +1,190 @@
+/*-------------------------------------------------------------------------------
+ *\file VM.hpp
+ *\info Header file for the bytecode compiler and the stack machine
+ * *----------------------------------------------------------------------------*/
+
+#ifndef VM_HEADER
+#define VM_HEADER
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "RS.hpp"
+#include "UT.hpp"
+#include <vector>
+
+namespace VM
+{
+
+/*------------------------------------------------------------------------------
+ *\TYPES
+ *-----------------------------------------------------------------------------*/
+
+#define VM_Op_EnumVariants                                                     \
+  X(Const)                                                                     \
+  X(Load)                                                                      \
+  X(Store)                                                                     \
+  X(LoadGlobal)                                                                \
+  X(Pop)                                                                       \
+  X(Add)                                                                       \
+  X(Sub)                                                                       \
+  X(Mult)                                                                      \
+  X(Div)                                                                       \
+  X(Modulus)                                                                   \
+  X(IsEq)                                                                      \
+  X(Minus)                                                                     \
+  X(Not)                                                                       \
+  X(Jump)                                                                      \
+  X(JumpIfNot)                                                                 \
+  X(NextFrame)                                                                 \
+  X(Call)                                                                      \
+  X(CallGlobal)                                                                \
+  X(TailCall)                                                                  \
+  X(TailCallGlobal)                                                            \
+  X(CallForeign)                                                               \
+  X(Return)
+
+enum class Op : uint8_t
+{
+#define X(X_enum) X_enum,
+  VM_Op_EnumVariants
+#undef X
+};
+
+// NOTE: m_argc is only used by the call instructions
+struct Instr
+{
+  Op       m_op;
+  uint16_t m_argc;
+  uint32_t m_arg;
+};
+
+struct Chunk
+{
+  const RS::Proto *m_proto;
+  Instr           *m_code;
+  size_t           m_len;
+  RS::Value       *m_consts;
+  TL::DFN        **m_foreign;
+  uint32_t         m_arity;
+  uint32_t         m_frame_len;
+  uint32_t         m_max_stack; // NOTE: temporaries on top of the frame
+};
+
+/*-------------------------------------------------------------------------------
+ *\CLASSES
+ *------------------------------------------------------------------------------*/
+
+class Compiler
+{
+public:
+  AR::Arena &m_arena;
+
+  Compiler(AR::Arena &arena);
+
+  Chunk *compile(const RS::Proto &proto);
+
+private:
+  std::vector<Instr>     m_code;
+  std::vector<RS::Value> m_consts;
+  std::vector<TL::DFN *> m_foreign;
+  bool                   m_ok;
+  int32_t                m_depth;
+  int32_t                m_max_depth;
+
+  size_t emit(Op op, uint32_t arg = 0, uint16_t argc = 0);
+
+  void patch(size_t at);
+
+  void lower(const RS::Node *node, bool tail = false);
+};
+
+class Machine
+{
+public:
+  static constexpr size_t STACK_LEN = 1 << 16; // NOTE: grows on demand
+
+  AR::Arena   &m_arena;
+  RS::Globals &m_globals;
+  RS::Runtime  m_fallback;
+  size_t       m_max_frames; // NOTE: nested calls before recursion fails
+
+  Machine(AR::Arena &arena, RS::Globals &globals, size_t max_frames);
+  ~Machine();
+
+  Machine(const Machine &)            = delete;
+  Machine &operator=(const Machine &) = delete;
+
+  RS::Value run(const RS::Proto &def);
+
+  // NOTE: Compiles def and every lambda inside of it ahead of time, machines
+  // that run on other threads never compile and only read the chunks
+  void prepare(const RS::Proto &def);
+
+private:
+  // NOTE: Offsets into the stack, so that it can be moved when it grows
+  struct CallFrame
+  {
+    const Chunk *m_chunk;
+    const Instr *m_ip;
+    size_t       m_base;
+    size_t       m_return_sp;
+  };
+
+  Compiler               m_compiler;
+  RS::Value             *m_stack; // NOTE: malloc'd, pages are touched lazily
+  size_t                 m_stack_len;
+  std::vector<CallFrame> m_frames;
+  size_t                 m_native_depth; // NOTE: no native calls from here on
+
+  const Chunk *chunk(const RS::Proto &proto);
+
+  void grow(size_t len);
+
+  RS::Value execute();
+};
+
+} // namespace VM
+
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+
+namespace std
+{
+inline string
+to_string(
+  VM::Op op)
+{
+  switch (op)
+  {
+#define X(X_enum)                                                              \
+  case VM::Op::X_enum: return #X_enum;
+    VM_Op_EnumVariants
+#undef X
+  }
+  UT_FAIL_IF("UNREACHABLE");
+  return "";
+}
+
+inline string
+to_string(
+  VM::Chunk chunk)
+{
+  string s{ "" };
+  for (size_t i = 0; i < chunk.m_len; ++i)
+  {
+    VM::Instr instr = chunk.m_code[i];
+    s += to_string(i) + ": " + to_string(instr.m_op) + " "
+         + to_string(instr.m_arg) + " " + to_string(instr.m_argc) + "\n";
+  }
+  return s;
+}
+} // namespace std
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+#endif // VM_HEADER
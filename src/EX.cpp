@@ -215,6 +215,12 @@ Parser::parse_binop(
 E
 Parser::run()
 {
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while parsing %zu tokens",
+                this->m_end - this->m_begin);
+  }
+
   E e{};
 
   for (size_t i = this->m_begin; i < this->m_end;)
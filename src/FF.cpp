@@ -0,0 +1,378 @@
+/*-------------------------------------------------------------------------------
+ *\file FF.cpp
+ *\info Calls into C libraries impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "FF.hpp"
+#include "LX.hpp"
+#include "UT.hpp"
+#include <array>
+#include <cstring>
+#include <dlfcn.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace FF
+{
+
+/*------------------------------------------------------------------------------
+ *\TYPES
+ *-----------------------------------------------------------------------------*/
+
+struct Library
+{
+  std::string                         m_path;
+  void                               *m_handle;
+  size_t                              m_refs;
+  std::unordered_map<UT::Sym, void *> m_symbols;
+};
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+// NOTE: A param is passed as an int or, if IS_PTR, as a pointer
+template <bool IS_PTR> struct Param
+{
+  using Type = int;
+
+  static Type
+  from(
+    ssize_t word)
+  {
+    return (Type)word;
+  }
+};
+
+template <> struct Param<true>
+{
+  using Type = void *;
+
+  static Type
+  from(
+    ssize_t word)
+  {
+    return (Type)word;
+  }
+};
+
+enum class Result
+{
+  Int,
+  Ptr,
+  Void,
+};
+
+// NOTE: Bit i of MASK is set when param i is a pointer
+template <Result RESULT, size_t MASK, size_t... I>
+ssize_t
+call(
+  void *fn, const ssize_t *args, std::index_sequence<I...>)
+{
+  (void)args;
+
+  if constexpr (Result::Void == RESULT)
+  {
+    using Fn = void (*)(typename Param<(MASK >> I) & 1>::Type...);
+    ((Fn)fn)(Param<(MASK >> I) & 1>::from(args[I])...);
+    return 0;
+  }
+  else if constexpr (Result::Ptr == RESULT)
+  {
+    using Fn = void *(*)(typename Param<(MASK >> I) & 1>::Type...);
+    return (ssize_t)((Fn)fn)(Param<(MASK >> I) & 1>::from(args[I])...);
+  }
+  else
+  {
+    using Fn = int (*)(typename Param<(MASK >> I) & 1>::Type...);
+    return ((Fn)fn)(Param<(MASK >> I) & 1>::from(args[I])...);
+  }
+}
+
+template <Result RESULT, size_t ARITY, size_t MASK>
+ssize_t
+direct(
+  void *fn, const ssize_t *args)
+{
+  return call<RESULT, MASK>(fn, args, std::make_index_sequence<ARITY>{});
+}
+
+// NOTE: One thunk for every mask of ARITY params, the thunk of a mask is at
+// its index
+template <Result RESULT, size_t ARITY, size_t... MASK>
+constexpr std::array<Thunk, sizeof...(MASK)>
+row(
+  std::index_sequence<MASK...>)
+{
+  return { { &direct<RESULT, ARITY, MASK>... } };
+}
+
+template <Result RESULT, size_t ARITY>
+Thunk
+row_at(
+  size_t mask)
+{
+  static constexpr std::array<Thunk, (size_t)1 << ARITY> thunks
+    = row<RESULT, ARITY>(std::make_index_sequence<(size_t)1 << ARITY>{});
+  return thunks[mask];
+}
+
+template <Result RESULT>
+Thunk
+select(
+  size_t arity, size_t mask)
+{
+  static_assert(6 == MAX_THUNK_ARGS, "select has a case for every arity");
+
+  switch (arity)
+  {
+  case 0 : return row_at<RESULT, 0>(mask);
+  case 1 : return row_at<RESULT, 1>(mask);
+  case 2 : return row_at<RESULT, 2>(mask);
+  case 3 : return row_at<RESULT, 3>(mask);
+  case 4 : return row_at<RESULT, 4>(mask);
+  case 5 : return row_at<RESULT, 5>(mask);
+  case 6 : return row_at<RESULT, 6>(mask);
+  default: return nullptr;
+  }
+}
+
+struct Registry
+{
+  std::mutex                                      m_mutex;
+  std::map<std::string, std::unique_ptr<Library>> m_libraries;
+  std::map<std::string, std::string>              m_redirects;
+};
+
+// NOTE: Lives for the whole process, like the symbol table
+Registry &
+registry()
+{
+  static Registry registry{};
+  return registry;
+}
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Libraries)
+ *------------------------------------------------------------------------------*/
+
+Library *
+Libraries::open(
+  UT::String path)
+{
+  Registry                   &table = registry();
+  std::lock_guard<std::mutex> lock{ table.m_mutex };
+
+  std::string key      = std::to_string(path);
+  auto        redirect = table.m_redirects.find(key);
+  if (table.m_redirects.end() != redirect) key = redirect->second;
+
+  std::unique_ptr<Library> &library = table.m_libraries[key];
+  if (!library)
+  {
+    // NOTE: An empty path is the program itself and what it has loaded
+    void *handle = dlopen(key.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+      table.m_libraries.erase(key);
+      UT_FAIL_MSG("ERROR: library (%s) could not be loaded: %s\n",
+                  key.c_str(),
+                  dlerror());
+    }
+    library = std::make_unique<Library>(Library{ key, handle, 0, {} });
+  }
+
+  library->m_refs += 1;
+  return library.get();
+}
+
+void
+Libraries::close(
+  Library *library)
+{
+  Registry                   &table = registry();
+  std::lock_guard<std::mutex> lock{ table.m_mutex };
+
+  library->m_refs -= 1;
+  if (library->m_refs) return;
+
+  dlclose(library->m_handle);
+  table.m_libraries.erase(library->m_path);
+}
+
+void *
+Libraries::find(
+  Library *library, UT::String name)
+{
+  Registry                   &table = registry();
+  std::lock_guard<std::mutex> lock{ table.m_mutex };
+
+  UT::String symbol = UT::intern(name);
+  auto       it     = library->m_symbols.find(symbol.m_sym);
+  if (library->m_symbols.end() != it) return it->second;
+
+  void *address = dlsym(library->m_handle, symbol.m_mem);
+  library->m_symbols[symbol.m_sym] = address;
+  return address;
+}
+
+void
+Libraries::redirect(
+  UT::String path, UT::String to)
+{
+  Registry                   &table = registry();
+  std::lock_guard<std::mutex> lock{ table.m_mutex };
+
+  table.m_redirects[std::to_string(path)] = std::to_string(to);
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (FF)
+ *------------------------------------------------------------------------------*/
+
+bool
+is_pointer(
+  LX::LangType type)
+{
+  switch (type)
+  {
+  case LX::LangType::Ptr:
+  case LX::LangType::Buf:
+  case LX::LangType::Ints:
+  case LX::LangType::Out : return true;
+  default                : return false;
+  }
+}
+
+Thunk
+thunk(
+  const LX::LangType *params, size_t arity, LX::LangType result)
+{
+  if (arity > MAX_THUNK_ARGS) return nullptr;
+
+  size_t mask = 0;
+  for (size_t i = 0; i < arity; ++i)
+  {
+    if (LX::LangType::Void == params[i]) return nullptr;
+    if (LX::LangType::Struct == params[i]) return nullptr;
+    if (is_pointer(params[i])) mask |= (size_t)1 << i;
+  }
+
+  if (LX::LangType::Struct == result) return nullptr;
+  if (is_pointer(result)) return select<Result::Ptr>(arity, mask);
+  if (LX::LangType::Void == result) return select<Result::Void>(arity, mask);
+  return select<Result::Int>(arity, mask);
+}
+
+Layout *
+layout(
+  const LX::LangType *fields, size_t len, AR::Arena &arena)
+{
+  auto elements = (ffi_type **)arena.alloc<ffi_type *>(len + 1);
+  for (size_t i = 0; i < len; ++i)
+  {
+    switch (fields[i])
+    {
+    case LX::LangType::Int  : elements[i] = &ffi_type_sint; break;
+    case LX::LangType::Nat8 : elements[i] = &ffi_type_uint8; break;
+    case LX::LangType::Float: elements[i] = &ffi_type_float; break;
+    default                 : return nullptr;
+    }
+  }
+  elements[len] = nullptr;
+
+  auto layout       = (Layout *)arena.alloc(sizeof(Layout));
+  layout->m_type    = ffi_type{ 0, 0, FFI_TYPE_STRUCT, elements };
+  layout->m_fields  = (LX::LangType *)arena.alloc<LX::LangType>(len);
+  layout->m_offsets = (size_t *)arena.alloc<size_t>(len);
+  layout->m_len     = len;
+  for (size_t i = 0; i < len; ++i) layout->m_fields[i] = fields[i];
+
+  // NOTE: Also sets the size and alignment of m_type
+  if (FFI_OK
+      != ffi_get_struct_offsets(
+        FFI_DEFAULT_ABI, &layout->m_type, layout->m_offsets))
+  {
+    return nullptr;
+  }
+  if (layout->m_type.size > MAX_STRUCT_SIZE) return nullptr;
+
+  return layout;
+}
+
+void
+pack(
+  const Layout &layout, const int *ints, void *c_struct)
+{
+  auto bytes = (unsigned char *)c_struct;
+  std::memset(bytes, 0, layout.m_type.size);
+  if (!ints) return;
+
+  for (size_t i = 0; i < layout.m_len; ++i)
+  {
+    unsigned char *field = bytes + layout.m_offsets[i];
+    switch (layout.m_fields[i])
+    {
+    case LX::LangType::Nat8:
+    {
+      uint8_t value = (uint8_t)ints[i];
+      std::memcpy(field, &value, sizeof(value));
+    }
+    break;
+    case LX::LangType::Float:
+    {
+      float value = (float)ints[i];
+      std::memcpy(field, &value, sizeof(value));
+    }
+    break;
+    default: std::memcpy(field, &ints[i], sizeof(int)); break;
+    }
+  }
+}
+
+void
+unpack(
+  const Layout &layout, const void *c_struct, int *ints)
+{
+  auto bytes = (const unsigned char *)c_struct;
+  for (size_t i = 0; i < layout.m_len; ++i)
+  {
+    const unsigned char *field = bytes + layout.m_offsets[i];
+    switch (layout.m_fields[i])
+    {
+    case LX::LangType::Nat8:
+    {
+      uint8_t value;
+      std::memcpy(&value, field, sizeof(value));
+      ints[i] = value;
+    }
+    break;
+    case LX::LangType::Float:
+    {
+      float value;
+      std::memcpy(&value, field, sizeof(value));
+      ints[i] = (int)value;
+    }
+    break;
+    default: std::memcpy(&ints[i], field, sizeof(int)); break;
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace FF
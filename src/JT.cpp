@@ -0,0 +1,476 @@
+/*-------------------------------------------------------------------------------
+ *\file JT.cpp
+ *\info x86-64 jit of integer functions impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "JT.hpp"
+#include "RS.hpp"
+#include "UT.hpp"
+#include <csetjmp>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace JT
+{
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+// NOTE: rdi, rsi, rdx, rcx, r8, r9
+constexpr uint8_t ARG_REGS[MAX_ARITY] = { 7, 6, 2, 1, 8, 9 };
+
+int32_t
+slot_offset(
+  uint32_t slot)
+{
+  return -8 * (int32_t)(slot + 1);
+}
+
+// NOTE: Where a native call that ran out of stack returns to
+thread_local jmp_buf *overflow_target = nullptr;
+
+// NOTE: Frame of the last call that ran out of stack, calls made from deeper
+// than it would run out as well, so they fail right away. It only holds while
+// the outermost call runs, the next evaluation may start from another depth
+thread_local uintptr_t overflow_frame = 0;
+
+// NOTE: Calls on the thread's stack, engines called back from native code can
+// call native code again
+thread_local uint32_t call_depth = 0;
+
+[[noreturn]] void
+overflow()
+{
+  longjmp(*overflow_target, 1);
+}
+
+void
+leave(
+  jmp_buf *outer_target)
+{
+  overflow_target = outer_target;
+  if (--call_depth == 0) overflow_frame = 0;
+}
+
+// NOTE: Offset of the stack floor from the thread pointer, the same for every
+// thread since the variable is initial-exec
+bool
+stack_floor_offset(
+  int32_t &offset)
+{
+#if defined(__x86_64__)
+  uintptr_t thread_pointer = 0;
+  asm("mov %%fs:0, %0" : "=r"(thread_pointer));
+
+  intptr_t distance
+    = (intptr_t)&UT::IMPL::stack_floor - (intptr_t)thread_pointer;
+  if (distance < INT32_MIN || distance > INT32_MAX) return false;
+
+  offset = distance;
+  return true;
+#else
+  (void)offset;
+  return false;
+#endif
+}
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Jit)
+ *------------------------------------------------------------------------------*/
+
+Jit::Jit()
+    : m_proto{ nullptr },
+      m_self{ 0 },
+      m_entry{ 0 },
+      m_depth{ 0 },
+      m_ok{ true }
+{
+}
+
+Jit::~Jit()
+{
+  for (Page page : this->m_pages) munmap(page.m_mem, page.m_len);
+}
+
+void
+Jit::emit(
+  std::initializer_list<uint8_t> bytes)
+{
+  this->m_code.insert(this->m_code.end(), bytes);
+}
+
+void
+Jit::emit_u32(
+  uint32_t word)
+{
+  for (size_t i = 0; i < 4; ++i) this->m_code.push_back(word >> (8 * i));
+}
+
+void
+Jit::emit_u64(
+  uint64_t word)
+{
+  for (size_t i = 0; i < 8; ++i) this->m_code.push_back(word >> (8 * i));
+}
+
+size_t
+Jit::emit_jump(
+  std::initializer_list<uint8_t> opcode)
+{
+  this->emit(opcode);
+  this->emit_u32(0);
+  return this->m_code.size() - 4;
+}
+
+void
+Jit::patch(
+  size_t at)
+{
+  uint32_t rel = this->m_code.size() - (at + 4);
+  for (size_t i = 0; i < 4; ++i) this->m_code[at + i] = rel >> (8 * i);
+}
+
+void
+Jit::load(
+  uint32_t slot)
+{
+  // mov rax, [rbp + disp32]
+  this->emit({ 0x48, 0x8B, 0x85 });
+  this->emit_u32(slot_offset(slot));
+}
+
+void
+Jit::store(
+  uint32_t slot, uint8_t reg)
+{
+  // mov [rbp + disp32], reg
+  this->emit({ (uint8_t)(0x48 | (reg >= 8 ? 0x04 : 0x00)),
+               0x89,
+               (uint8_t)(0x85 | ((reg & 7) << 3)) });
+  this->emit_u32(slot_offset(slot));
+}
+
+void
+Jit::lower(
+  const RS::Node *node, bool tail)
+{
+  if (!this->m_ok) return;
+
+  switch (node->m_op)
+  {
+  case RS::Op::Int:
+  {
+    // mov rax, imm64
+    this->emit({ 0x48, 0xB8 });
+    this->emit_u64(node->as.m_int);
+  }
+  break;
+  case RS::Op::Local:
+  {
+    if (0 != node->as.m_local.m_depth)
+    {
+      this->m_ok = false;
+      return;
+    }
+    this->load(node->as.m_local.m_slot);
+  }
+  break;
+  case RS::Op::Call:
+  {
+    const RS::Call &call = node->as.m_call;
+    if (RS::Op::Global != call.m_callee->m_op
+        || this->m_self != call.m_callee->as.m_global
+        || this->m_proto->m_arity != call.m_argc)
+    {
+      this->m_ok = false;
+      return;
+    }
+
+    for (uint32_t i = 0; i < call.m_argc; ++i)
+    {
+      this->lower(call.m_args[i]);
+      this->emit({ 0x50 }); // push rax
+      this->m_depth += 1;
+    }
+
+    // NOTE: A self call in tail position rebinds the params and jumps back
+    if (tail)
+    {
+      for (uint32_t i = call.m_argc; i-- > 0;)
+      {
+        this->emit({ 0x58 }); // pop rax
+        this->store(i, 0);
+        this->m_depth -= 1;
+      }
+      size_t   at  = this->emit_jump({ 0xE9 });
+      uint32_t rel = this->m_entry - (at + 4);
+      for (size_t i = 0; i < 4; ++i) this->m_code[at + i] = rel >> (8 * i);
+      break;
+    }
+
+    for (uint32_t i = call.m_argc; i-- > 0;)
+    {
+      uint8_t reg = ARG_REGS[i];
+      if (reg >= 8) this->emit({ 0x41, (uint8_t)(0x58 + (reg & 7)) });
+      else this->emit({ (uint8_t)(0x58 + reg) });
+      this->m_depth -= 1;
+    }
+
+    // NOTE: Keep rsp 16 byte aligned at the call
+    bool pad = this->m_depth % 2;
+    if (pad) this->emit({ 0x48, 0x83, 0xEC, 0x08 }); // sub rsp, 8
+    this->m_self_calls.push_back(this->emit_jump({ 0xE8 }));
+    if (pad) this->emit({ 0x48, 0x83, 0xC4, 0x08 }); // add rsp, 8
+  }
+  break;
+  case RS::Op::Add:
+  case RS::Op::Sub:
+  case RS::Op::Mult:
+  case RS::Op::Div:
+  case RS::Op::Modulus:
+  case RS::Op::IsEq:
+  {
+    this->lower(node->as.m_bin.m_left);
+    this->emit({ 0x50 }); // push rax
+    this->m_depth += 1;
+    this->lower(node->as.m_bin.m_right);
+    this->emit({ 0x48, 0x89, 0xC1 }); // mov rcx, rax
+    this->emit({ 0x58 });             // pop rax
+    this->m_depth -= 1;
+
+    switch (node->m_op)
+    {
+    case RS::Op::Add : this->emit({ 0x48, 0x01, 0xC8 }); break;
+    case RS::Op::Sub : this->emit({ 0x48, 0x29, 0xC8 }); break;
+    case RS::Op::Mult: this->emit({ 0x48, 0x0F, 0xAF, 0xC1 }); break;
+    case RS::Op::Div : this->emit({ 0x48, 0x99, 0x48, 0xF7, 0xF9 }); break;
+    case RS::Op::Modulus:
+    {
+      this->emit({ 0x48, 0x99, 0x48, 0xF7, 0xF9 }); // cqo; idiv rcx
+      this->emit({ 0x48, 0x89, 0xD0 });             // mov rax, rdx
+    }
+    break;
+    case RS::Op::IsEq:
+    {
+      this->emit({ 0x48, 0x39, 0xC8 }); // cmp rax, rcx
+      this->emit({ 0x0F, 0x94, 0xC0 }); // sete al
+      this->emit({ 0x0F, 0xB6, 0xC0 }); // movzx eax, al
+    }
+    break;
+    default: UT_FAIL_IF("UNREACHABLE");
+    }
+  }
+  break;
+  case RS::Op::Minus:
+  {
+    this->lower(node->as.m_operand);
+    this->emit({ 0x48, 0xF7, 0xD8 }); // neg rax
+  }
+  break;
+  case RS::Op::Not:
+  {
+    this->lower(node->as.m_operand);
+    this->emit({ 0x48, 0x85, 0xC0 }); // test rax, rax
+    this->emit({ 0x0F, 0x94, 0xC0 }); // sete al
+    this->emit({ 0x0F, 0xB6, 0xC0 }); // movzx eax, al
+  }
+  break;
+  case RS::Op::If:
+  {
+    const RS::If &if_else = node->as.m_if;
+
+    this->lower(if_else.m_condition);
+    this->emit({ 0x48, 0x85, 0xC0 }); // test rax, rax
+    size_t to_else = this->emit_jump({ 0x0F, 0x84 });
+    this->lower(if_else.m_true_branch, tail);
+    size_t to_end = this->emit_jump({ 0xE9 });
+    this->patch(to_else);
+    this->lower(if_else.m_else_branch, tail);
+    this->patch(to_end);
+  }
+  break;
+  case RS::Op::Let:
+  {
+    const RS::Let &let = node->as.m_let;
+    if (0 != let.m_target.m_depth)
+    {
+      this->m_ok = false;
+      return;
+    }
+    this->lower(let.m_value);
+    this->store(let.m_target.m_slot, 0);
+    this->lower(let.m_continuation, tail);
+  }
+  break;
+  case RS::Op::Str:
+  case RS::Op::Global:
+  case RS::Op::Lambda:
+  case RS::Op::ForeignCall:
+  case RS::Op::While:
+  {
+    this->m_ok = false;
+  }
+  break;
+  }
+}
+
+void *
+Jit::install()
+{
+  size_t page_len = sysconf(_SC_PAGESIZE);
+  size_t len      = (this->m_code.size() + page_len - 1) / page_len * page_len;
+
+  void *mem = mmap(
+    nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == mem) return nullptr;
+
+  std::memcpy(mem, this->m_code.data(), this->m_code.size());
+  if (mprotect(mem, len, PROT_READ | PROT_EXEC))
+  {
+    munmap(mem, len);
+    return nullptr;
+  }
+
+  this->m_pages.push_back(Page{ mem, len });
+  return mem;
+}
+
+bool
+Jit::compile(
+  RS::Value value, uint32_t self)
+{
+#if defined(__x86_64__)
+  if (RS::Kind::Fn != value.m_kind) return false;
+
+  const RS::Closure &closure = value.as.m_fn;
+  const RS::Proto   &proto   = *closure.m_proto;
+  if (closure.m_env || closure.m_partial || proto.m_captures) return false;
+  if (proto.m_native) return true;
+  if (proto.m_arity > MAX_ARITY) return false;
+
+  this->m_code.clear();
+  this->m_self_calls.clear();
+  this->m_proto = &proto;
+  this->m_self  = self;
+  this->m_depth = 0;
+  this->m_ok    = true;
+
+  // NOTE: Every slot lives at [rbp - 8 * (slot + 1)], the frame is rounded
+  // up so that rsp stays 16 byte aligned
+  uint32_t frame_len = (8 * proto.m_frame_len + 15) / 16 * 16;
+
+  // NOTE: Every call checks rsp against the stack floor of the thread, once it
+  // is below the call is abandoned and left to the interpreter
+  int32_t floor_offset = 0;
+  if (!stack_floor_offset(floor_offset)) return false;
+
+  this->emit({ 0x64, 0x48, 0x3B, 0x24, 0x25 }); // cmp rsp, fs:[disp32]
+  this->emit_u32(floor_offset);
+  size_t to_overflow = this->emit_jump({ 0x0F, 0x82 }); // jb rel32
+
+  this->emit({ 0x55 });             // push rbp
+  this->emit({ 0x48, 0x89, 0xE5 }); // mov rbp, rsp
+  this->emit({ 0x48, 0x81, 0xEC }); // sub rsp, imm32
+  this->emit_u32(frame_len);
+  for (uint32_t i = 0; i < proto.m_arity; ++i) this->store(i, ARG_REGS[i]);
+
+  this->m_entry = this->m_code.size();
+  this->lower(proto.m_body, true);
+
+  this->emit({ 0xC9 }); // leave
+  this->emit({ 0xC3 }); // ret
+
+  this->patch(to_overflow);
+  this->emit({ 0x48, 0x83, 0xE4, 0xF0 }); // and rsp, -16
+  this->emit({ 0x48, 0xB8 });             // mov rax, imm64
+  this->emit_u64((uint64_t)&overflow);
+  this->emit({ 0xFF, 0xD0 }); // call rax
+
+  if (!this->m_ok) return false;
+
+  for (size_t at : this->m_self_calls)
+  {
+    uint32_t rel = -(int32_t)(at + 4);
+    for (size_t i = 0; i < 4; ++i) this->m_code[at + i] = rel >> (8 * i);
+  }
+
+  proto.m_native = this->install();
+  return proto.m_native;
+#else
+  (void)value;
+  (void)self;
+  return false;
+#endif
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (JT)
+ *------------------------------------------------------------------------------*/
+
+bool
+call(
+  const void *code, const ssize_t *args, uint32_t argc, ssize_t &result)
+{
+  // NOTE: The floor is read by the jitted code, it has to be set before
+  UT::stack_floor();
+
+  uintptr_t frame = (uintptr_t)__builtin_frame_address(0);
+  if (frame < overflow_frame) return false;
+
+  // NOTE: Restored on the way out so the target never points at a jmp_buf
+  // whose call has returned
+  jmp_buf *outer_target = overflow_target;
+  ++call_depth;
+
+  jmp_buf target;
+  if (setjmp(target))
+  {
+    overflow_frame = frame;
+    leave(outer_target);
+    return false;
+  }
+  overflow_target = &target;
+
+  using Fn0 = ssize_t (*)();
+  using Fn1 = ssize_t (*)(ssize_t);
+  using Fn2 = ssize_t (*)(ssize_t, ssize_t);
+  using Fn3 = ssize_t (*)(ssize_t, ssize_t, ssize_t);
+  using Fn4 = ssize_t (*)(ssize_t, ssize_t, ssize_t, ssize_t);
+  using Fn5 = ssize_t (*)(ssize_t, ssize_t, ssize_t, ssize_t, ssize_t);
+  using Fn6 = ssize_t (*)(ssize_t, ssize_t, ssize_t, ssize_t, ssize_t, ssize_t);
+
+  switch (argc)
+  {
+  case 0: result = ((Fn0)code)(); break;
+  case 1: result = ((Fn1)code)(args[0]); break;
+  case 2: result = ((Fn2)code)(args[0], args[1]); break;
+  case 3: result = ((Fn3)code)(args[0], args[1], args[2]); break;
+  case 4: result = ((Fn4)code)(args[0], args[1], args[2], args[3]); break;
+  case 5:
+    result = ((Fn5)code)(args[0], args[1], args[2], args[3], args[4]);
+    break;
+  case 6:
+    result
+      = ((Fn6)code)(args[0], args[1], args[2], args[3], args[4], args[5]);
+    break;
+  default: UT_FAIL_MSG("Native functions take at most %u params", MAX_ARITY);
+  }
+  leave(outer_target);
+  return true;
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace JT
@@ -9,6 +9,13 @@
 
 #include "LX.hpp"
 #include "UT.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace LX
 {
@@ -19,7 +26,7 @@ namespace
  *------------------------------------------------------------------------------*/
 {
 
-bool
+constexpr bool
 is_white_space(
   char c)
 {
@@ -42,64 +49,40 @@ parse_sig(
   Sig sig{};
 
   // TODO: Don't hardcode types like that
-  if ("C_int" == types[idx])
+  // TODO: The pointers should indicate what they point to
+  Sig leaf{};
+  if ("C_int" == types[idx]) leaf.type = LangType::Int;
+  else if ("C_void" == types[idx]) leaf.type = LangType::Void;
+  else if ("C_str" == types[idx]) leaf.type = LangType::Ptr;
+  else if ("C_buf" == types[idx]) leaf.type = LangType::Buf;
+  else if ("C_ints" == types[idx]) leaf.type = LangType::Ints;
+  else if ("C_out" == types[idx]) leaf.type = LangType::Out;
+  else if ("C_byte" == types[idx]) leaf.type = LangType::Nat8;
+  else if ("C_float" == types[idx]) leaf.type = LangType::Float;
+  else
   {
-    if (idx == types.m_len - 1)
-    {
-      sig.type = LangType::Int;
-    }
-    else
-    {
-      sig.type            = LangType::Fn;
-      UT::Pair<Sig> *pair = &sig.as.pair;
-      *pair               = { arena };
-      pair->begin()->type = LangType::Int;
-      *pair->last()       = parse_sig(types, arena, idx + 1).second;
-      sig.as.pair         = *pair;
-    }
+    // NOTE: Any other word names an ext struct, TL checks that it exists
+    leaf.type    = LangType::Struct;
+    leaf.as.name = UT::symbol(types[idx]);
   }
-  else if ("C_void" == types[idx])
-  {
-    if (idx == types.m_len - 1)
-    {
-      sig.type = LangType::Void;
-    }
-    else
-    {
-      sig.type            = LangType::Fn;
-      UT::Pair<Sig> *pair = &sig.as.pair;
-      *pair               = { arena };
-      pair->begin()->type = LangType::Void;
-      *pair->last()       = parse_sig(types, arena, idx + 1).second;
-      sig.as.pair         = *pair;
-    }
-  }
-  else if ("C_str" == types[idx])
+
+  if (idx == types.m_len - 1)
   {
-    if (idx == types.m_len - 1)
-    {
-      // TODO: The pointer should indicate what it points to
-      sig.type = LangType::Ptr;
-    }
-    else
-    {
-      sig.type            = LangType::Fn;
-      UT::Pair<Sig> *pair = &sig.as.pair;
-      *pair               = { arena };
-      // TODO: this should also include the type behind the pointer
-      pair->begin()->type = LangType::Ptr;
-      *pair->last()       = parse_sig(types, arena, idx + 1).second;
-      sig.as.pair         = *pair;
-    }
+    sig = leaf;
   }
   else
   {
-    // TODO: Think how to handle the other cases
+    sig.type            = LangType::Fn;
+    UT::Pair<Sig> *pair = &sig.as.pair;
+    *pair               = { arena };
+    *pair->begin()      = leaf;
+    *pair->last()       = parse_sig(types, arena, idx + 1).second;
+    sig.as.pair         = *pair;
   }
   return std::pair{ LX::E::OK, sig };
 }
 
-bool
+constexpr bool
 delimits_word(
   char c)
 {
@@ -129,12 +112,311 @@ delimits_word(
   }
 }
 
+template <Scan SCAN>
+constexpr bool
+stops(
+  char c)
+{
+  switch (SCAN)
+  {
+  case Scan::WhiteSpace: return !is_white_space(c);
+  case Scan::Word      : return !c || delimits_word(c);
+  case Scan::Name      : return !c || delimits_word(c) || '#' == c || '"' == c;
+  case Scan::Line      : return !c || '\n' == c;
+  case Scan::Quote     : return !c || '"' == c;
+  }
+  return true;
+}
+
+template <Scan SCAN> struct Stops
+{
+  bool m_bytes[256];
+
+  constexpr Stops()
+      : m_bytes{}
+  {
+    for (size_t c = 0; c < 256; ++c) this->m_bytes[c] = stops<SCAN>((char)c);
+  }
+};
+
+// NOTE: One lookup per byte instead of the switch of stops
+template <Scan SCAN> constexpr Stops<SCAN> STOPS{};
+
+template <Scan SCAN>
+size_t
+scan_scalar(
+  const char *input, size_t idx)
+{
+  while (!STOPS<SCAN>.m_bytes[(uint8_t)input[idx]]) idx += 1;
+  return idx;
+}
+
+#if defined(__x86_64__)
+
+// NOTE: Word and Name only stop at bytes up to 0x7F, so every byte can be
+// classified with two table lookups, one on each nibble. The entry of a low
+// nibble has the bit of every high nibble that makes a byte of the set. The
+// tables are repeated for each lane of AVX2.
+template <Scan SCAN> struct Nibbles
+{
+  alignas(32) uint8_t m_low[32];
+  alignas(32) uint8_t m_high[32];
+
+  constexpr Nibbles()
+      : m_low{},
+        m_high{}
+  {
+    for (size_t c = 0; c < 0x80; ++c)
+    {
+      if (!stops<SCAN>((char)c)) continue;
+      this->m_low[c & 0x0F] |= 1 << (c >> 4);
+      this->m_low[16 + (c & 0x0F)] |= 1 << (c >> 4);
+    }
+    for (size_t high = 0; high < 8; ++high)
+    {
+      this->m_high[high]      = 1 << high;
+      this->m_high[16 + high] = 1 << high;
+    }
+  }
+};
+
+template <Scan SCAN> constexpr Nibbles<SCAN> NIBBLES{};
+
+// NOTE: The vector scans load aligned blocks, which never cross a page, so they
+// may read past the NUL that ends the input but never past its page. Bytes of
+// the first block that come before idx are shifted out of the mask. Those reads
+// are outside the input, so the scans are not instrumented by ASan.
+
+__attribute__((target("ssse3"))) inline __m128i
+bytes_equal(
+  __m128i block, char c)
+{
+  return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+}
+
+template <Scan SCAN>
+__attribute__((target("ssse3"))) uint32_t
+stop_mask(
+  __m128i block)
+{
+  __m128i hit = _mm_setzero_si128();
+  switch (SCAN)
+  {
+  case Scan::WhiteSpace:
+  {
+    hit = _mm_or_si128(
+      _mm_or_si128(bytes_equal(block, ' '), bytes_equal(block, '\t')),
+      bytes_equal(block, '\n'));
+    return ~_mm_movemask_epi8(hit) & 0xFFFF;
+  }
+  case Scan::Word:
+  case Scan::Name:
+  {
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i low_table
+      = _mm_load_si128((const __m128i *)NIBBLES<SCAN>.m_low);
+    const __m128i high_table
+      = _mm_load_si128((const __m128i *)NIBBLES<SCAN>.m_high);
+
+    __m128i low  = _mm_and_si128(block, nibble);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(block, 4), nibble);
+    __m128i bits = _mm_and_si128(_mm_shuffle_epi8(low_table, low),
+                                 _mm_shuffle_epi8(high_table, high));
+    return ~_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128()))
+           & 0xFFFF;
+  }
+  case Scan::Line:
+  {
+    hit = _mm_or_si128(bytes_equal(block, '\n'), bytes_equal(block, '\0'));
+  }
+  break;
+  case Scan::Quote:
+  {
+    hit = _mm_or_si128(bytes_equal(block, '"'), bytes_equal(block, '\0'));
+  }
+  break;
+  }
+  return _mm_movemask_epi8(hit);
+}
+
+template <Scan SCAN>
+__attribute__((target("ssse3"), no_sanitize_address)) size_t
+scan_ssse3(
+  const char *input, size_t idx)
+{
+  const char *at    = input + idx;
+  const char *block = (const char *)((uintptr_t)at & ~(uintptr_t)15);
+
+  uint32_t mask = stop_mask<SCAN>(_mm_load_si128((const __m128i *)block));
+  mask >>= at - block;
+  if (mask) return idx + __builtin_ctz(mask);
+
+  for (;;)
+  {
+    block += 16;
+    mask = stop_mask<SCAN>(_mm_load_si128((const __m128i *)block));
+    if (mask) return block - input + __builtin_ctz(mask);
+  }
+}
+
+__attribute__((target("avx2"))) inline __m256i
+bytes_equal(
+  __m256i block, char c)
+{
+  return _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c));
+}
+
+template <Scan SCAN>
+__attribute__((target("avx2"))) uint32_t
+stop_mask(
+  __m256i block)
+{
+  __m256i hit = _mm256_setzero_si256();
+  switch (SCAN)
+  {
+  case Scan::WhiteSpace:
+  {
+    hit = _mm256_or_si256(
+      _mm256_or_si256(bytes_equal(block, ' '), bytes_equal(block, '\t')),
+      bytes_equal(block, '\n'));
+    return ~(uint32_t)_mm256_movemask_epi8(hit);
+  }
+  case Scan::Word:
+  case Scan::Name:
+  {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i low_table
+      = _mm256_load_si256((const __m256i *)NIBBLES<SCAN>.m_low);
+    const __m256i high_table
+      = _mm256_load_si256((const __m256i *)NIBBLES<SCAN>.m_high);
+
+    __m256i low  = _mm256_and_si256(block, nibble);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble);
+    __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(low_table, low),
+                                    _mm256_shuffle_epi8(high_table, high));
+    return ~(uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(bits, _mm256_setzero_si256()));
+  }
+  case Scan::Line:
+  {
+    hit = _mm256_or_si256(bytes_equal(block, '\n'), bytes_equal(block, '\0'));
+  }
+  break;
+  case Scan::Quote:
+  {
+    hit = _mm256_or_si256(bytes_equal(block, '"'), bytes_equal(block, '\0'));
+  }
+  break;
+  }
+  return _mm256_movemask_epi8(hit);
+}
+
+template <Scan SCAN>
+__attribute__((target("avx2"), no_sanitize_address)) size_t
+scan_avx2(
+  const char *input, size_t idx)
+{
+  const char *at    = input + idx;
+  const char *block = (const char *)((uintptr_t)at & ~(uintptr_t)31);
+
+  uint32_t mask = stop_mask<SCAN>(_mm256_load_si256((const __m256i *)block));
+  mask >>= at - block;
+  if (mask) return idx + __builtin_ctz(mask);
+
+  for (;;)
+  {
+    block += 32;
+    mask = stop_mask<SCAN>(_mm256_load_si256((const __m256i *)block));
+    if (mask) return block - input + __builtin_ctz(mask);
+  }
+}
+
+#endif
+
+// NOTE: The offset of the byte the run that begins at idx stops at. The kernel
+// is picked once for the CPU.
+template <Scan SCAN>
+size_t
+scan(
+  const char *input, size_t idx)
+{
+  using Kernel = size_t (*)(const char *, size_t);
+
+  static const Kernel kernel = []() -> Kernel {
+#if defined(__x86_64__)
+    if (has_scan_kernel(ScanKernel::AVX2)) return &scan_avx2<SCAN>;
+    if (has_scan_kernel(ScanKernel::SSSE3)) return &scan_ssse3<SCAN>;
+#endif
+    return &scan_scalar<SCAN>;
+  }();
+
+  // NOTE: Most runs are short, so their first bytes are checked one at a time
+  for (size_t end = idx + 8; idx < end; ++idx)
+  {
+    if (STOPS<SCAN>.m_bytes[(uint8_t)input[idx]]) return idx;
+  }
+  return kernel(input, idx);
+}
+
+template <Scan SCAN>
+size_t
+scan_with(
+  ScanKernel kernel, const char *input, size_t idx)
+{
+  switch (kernel)
+  {
+  case ScanKernel::Scalar: return scan_scalar<SCAN>(input, idx);
+#if defined(__x86_64__)
+  case ScanKernel::SSSE3: return scan_ssse3<SCAN>(input, idx);
+  case ScanKernel::AVX2 : return scan_avx2<SCAN>(input, idx);
+#else
+  default: break;
+#endif
+  }
+  UT_FAIL_MSG("The CPU has no %d scan kernel", (int)kernel);
+  return idx;
+}
+
 } // namespace
 
 /*-------------------------------------------------------------------------------
  *\IMPL (LX)
  *------------------------------------------------------------------------------*/
 
+bool
+has_scan_kernel(
+  ScanKernel kernel)
+{
+  switch (kernel)
+  {
+  case ScanKernel::Scalar: return true;
+#if defined(__x86_64__)
+  case ScanKernel::SSSE3: return __builtin_cpu_supports("ssse3");
+  case ScanKernel::AVX2 : return __builtin_cpu_supports("avx2");
+#else
+  default: break;
+#endif
+  }
+  return false;
+}
+
+size_t
+scan_with(
+  ScanKernel kernel, Scan scan, const char *input, size_t idx)
+{
+  UT_FAIL_IF(!has_scan_kernel(kernel));
+
+  switch (scan)
+  {
+  case Scan::WhiteSpace: return scan_with<Scan::WhiteSpace>(kernel, input, idx);
+  case Scan::Word      : return scan_with<Scan::Word>(kernel, input, idx);
+  case Scan::Name      : return scan_with<Scan::Name>(kernel, input, idx);
+  case Scan::Line      : return scan_with<Scan::Line>(kernel, input, idx);
+  case Scan::Quote     : return scan_with<Scan::Quote>(kernel, input, idx);
+  }
+  return idx;
+}
+
 ErrorE::ErrorE(
   AR::Arena  &arena,
   const char *fn_name,
@@ -175,57 +457,24 @@ UT::String
 Lexer::get_word(
   size_t idx)
 {
-  UT::SB sb{};
   this->strip_white_space(idx);
   idx = this->m_cursor;
 
-  for (char c = m_input[idx++]; c; c = m_input[idx++])
-  {
-    if (delimits_word(c))
-    {
-      if (!is_white_space(c))
-      {
-        idx -= 1;
-      }
-      break;
-    }
-    sb.add(c);
-  }
+  size_t begin = idx;
+  size_t end   = scan<Scan::Word>(m_input, idx);
+  size_t len   = end - begin;
+
+  // NOTE: A white space that ends the word is taken with it
+  idx = is_white_space(m_input[end]) ? end + 1 : end;
 
-  UT::String string = sb.to_String(m_arena);
+  // NOTE: Words are interned, so the names in the tree are NUL terminated and
+  // carry their symbol id
+  UT::String string = UT::intern(UT::String{ m_input + begin, len });
   m_cursor          = idx;
 
   return string;
 }
 
-LX::E
-Lexer::find_matching_paren(
-  size_t &paren_match_idx)
-{
-  size_t stack = 1;
-
-  for (size_t idx = this->m_cursor; idx < this->m_end; ++idx)
-  {
-    char c = this->m_input[idx];
-    if (')' == c)
-    {
-      stack -= 1;
-    }
-    else if ('(' == c)
-    {
-      stack += 1;
-    }
-    if (0 == stack)
-    {
-      paren_match_idx = idx;
-
-      return LX::E::OK;
-    }
-  }
-
-  LX_ERROR_REPORT(LX::E::PARENTHESIS_UNBALANCED, "");
-}
-
 char
 Lexer::next_char()
 {
@@ -263,6 +512,7 @@ Lexer::push_int()
       case '/':
       case '%':
       case '?':
+      case ')':
       case '=': this->m_cursor -= 1; break;
       case '|':
       case '^':
@@ -275,7 +525,6 @@ Lexer::push_int()
         LX_ERROR_REPORT(LX::E::NUMBER_PARSING_FAILURE,
                         "Symbol reserved but currently not parse-able");
         break;
-      case ')':
       case ' ':
       case '\t':
       case '\n': break;
@@ -327,10 +576,16 @@ Lexer::push_operator(
   m_tokens.push(Token{ t_type });
 }
 
+// NOTE: One pass over the input. A '(' records where its tokens begin on the
+// group stack, the ')' that matches it moves them into one Group token. A ')'
+// with no group of this lexer open ends the group of the lexer that made this
+// one, which gets GROUP_END and closes it in turn.
 // TODO: candidate for refactor
 LX::E
 Lexer::run()
 {
+  std::vector<size_t> groups{}; // NOTE: where the tokens of each group begin
+
   for (char c = this->next_char(); //
        c;                          //
        c = this->next_char()       //
@@ -404,13 +659,21 @@ Lexer::run()
     break;
     case '"':
     {
-      UT::SB sb{};
-      for (char c = this->next_char(); c && c != '"'; c = this->next_char())
-      {
-        sb.add(c);
-      }
+      // NOTE: Strings have no escapes, so the bytes of the source are the
+      // string. They are copied once, since C gets the address of a C_str and
+      // needs the NUL the source does not have.
+      const char *input = this->m_input;
+      size_t      begin = this->m_cursor;
+      size_t      end = std::min(scan<Scan::Quote>(input, begin), this->m_end);
+
+      this->m_lines += std::count(input + begin, input + end, '\n');
+      this->m_cursor = '"' == input[end] && end < this->m_end ? end + 1 : end;
 
-      UT::String string = sb.to_String(m_arena);
+      char *mem = (char *)m_arena.alloc(end - begin + 1);
+      std::memcpy(mem, input + begin, end - begin);
+      mem[end - begin] = '\0';
+
+      UT::String string{ mem, end - begin };
       Token      string_token{ Type::Str };
       string_token.as.string = string;
 
@@ -445,15 +708,7 @@ Lexer::run()
     break;
     case '(':
     {
-      size_t group_begin = this->m_cursor + 1;
-      size_t group_end   = group_begin;
-
-      LX_FN_TRY(this->find_matching_paren(group_end));
-
-      Lexer new_l = Lexer(*this, group_begin, group_end);
-      LX_FN_TRY(new_l());
-
-      this->push_group(new_l);
+      groups.push_back(this->m_tokens.m_len);
     }
     break;
     case '?':
@@ -465,8 +720,7 @@ Lexer::run()
     break;
     case ')':
     {
-      LX_ERROR_REPORT(LX::E::UNREACHABLE_CASE_REACHED,
-                      "')' should never match in this branch");
+      if (!this->close_group(groups)) return E::GROUP_END;
     }
     break;
     case '\r': // For windows compatibility
@@ -478,7 +732,14 @@ Lexer::run()
     case ' ':  // Spaces are white-space
     case '\n': // New lines are white-space
     {
-      ; // Do nothing
+      // NOTE: The rest of the run is skipped at once
+      const char *input = this->m_input;
+      if (!is_white_space(input[this->m_cursor])) break;
+
+      size_t end
+        = std::min(scan<Scan::WhiteSpace>(input, this->m_cursor), this->m_end);
+      this->m_lines += std::count(input + this->m_cursor, input + end, '\n');
+      this->m_cursor = end;
     }
     break;
     case '\0':
@@ -489,6 +750,7 @@ Lexer::run()
     case '=':
     {
       LX_ASSERT('>' == this->next_char(), LX::E::OPERATOR_MATCH_FAILURE);
+      LX_ASSERT(groups.empty(), E::PARENTHESIS_UNBALANCED);
       return E::FAT_ARROW;
     }
     break;
@@ -503,7 +765,8 @@ Lexer::run()
         this->m_input, this->m_arena, this->m_cursor, this->m_end
       };
       LX::E e = body_lexer();
-      LX_ASSERT(LX::E::OK == e || LX::E::IN_KEYWORD == e,
+      LX_ASSERT(LX::E::OK == e || LX::E::IN_KEYWORD == e
+                  || LX::E::GROUP_END == e,
                 LX::E::CONTROL_STRUCTURE_ERROR);
 
       Token fn{};
@@ -516,6 +779,7 @@ Lexer::run()
       this->m_tokens.push(fn);
       this->skip_to(body_lexer);
 
+      if (E::GROUP_END == e && this->close_group(groups)) break;
       return e;
     }
     break;
@@ -565,10 +829,12 @@ Lexer::run()
 
       if (this->match_keyword(Keyword::IN, word))
       {
+        LX_ASSERT(groups.empty(), E::PARENTHESIS_UNBALANCED);
         return LX::E::IN_KEYWORD;
       }
       else if (this->match_keyword(Keyword::ELSE, word))
       {
+        LX_ASSERT(groups.empty(), E::PARENTHESIS_UNBALANCED);
         return LX::E::ELSE_KEYWORD;
       }
       else if (this->match_keyword(Keyword::INT, word)
@@ -613,7 +879,9 @@ Lexer::run()
         Lexer in_lexer{
           let_lexer.m_input, let_lexer.m_arena, let_lexer.m_cursor, this->m_end
         };
-        LX_FN_TRY(in_lexer());
+        LX::E e = in_lexer();
+        LX_ASSERT(LX::E::OK == e || LX::E::GROUP_END == e,
+                  LX::E::CONTROL_STRUCTURE_ERROR);
 
         // TODO: Token should have an end
         Token token{ Type::Let };
@@ -625,6 +893,8 @@ Lexer::run()
 
         this->m_tokens.push(token);
         this->skip_to(in_lexer);
+
+        if (E::GROUP_END == e && !this->close_group(groups)) return e;
       }
       else if (this->match_keyword(Keyword::IF, word))
       {
@@ -646,7 +916,8 @@ Lexer::run()
                                  true_branch_lexer.m_cursor,
                                  this->m_end };
         LX::E e = else_branch_lexer();
-        LX_ASSERT(LX::E::OK == e || LX::E::IN_KEYWORD == e,
+        LX_ASSERT(LX::E::OK == e || LX::E::IN_KEYWORD == e
+                    || LX::E::GROUP_END == e,
                   LX::E::CONTROL_STRUCTURE_ERROR);
 
         // TODO: candidate for refactor
@@ -659,6 +930,7 @@ Lexer::run()
         this->skip_to(else_branch_lexer);
 
         if (E::IN_KEYWORD == e) return e;
+        if (E::GROUP_END == e && !this->close_group(groups)) return e;
       }
       else if (this->match_keyword(Keyword::WHILE, word))
       {
@@ -672,7 +944,8 @@ Lexer::run()
                           condition_lexer.m_cursor,
                           this->m_end };
         LX::E e = body_lexer();
-        LX_ASSERT(e == E::ELSE_KEYWORD || e == E::IN_KEYWORD || e == E::OK,
+        LX_ASSERT(e == E::ELSE_KEYWORD || e == E::IN_KEYWORD || e == E::OK
+                    || e == E::GROUP_END,
                   E::CONTROL_STRUCTURE_ERROR);
 
         // TODO: candidate for refactor
@@ -684,6 +957,7 @@ Lexer::run()
         this->skip_to(body_lexer);
 
         if (E::IN_KEYWORD == e || e == E::ELSE_KEYWORD) return e;
+        if (E::GROUP_END == e && !this->close_group(groups)) return e;
       }
       else if (this->match_keyword(Keyword::EXT, word))
       {
@@ -698,6 +972,32 @@ Lexer::run()
 
         LX_FN_TRY(this->match_operator(':'));
 
+        // NOTE: ext name: struct T T T, the fields of a C struct in order
+        Lexer struct_lexer{ m_input, m_arena, m_cursor, next_symbol_idx };
+        UT::String first = struct_lexer.get_word(struct_lexer.m_cursor);
+        if (this->match_keyword(Keyword::STRUCT, first))
+        {
+          UT::Vec<UT::String> fields{ m_arena };
+          for (struct_lexer.strip_white_space(struct_lexer.m_cursor);
+               struct_lexer.m_cursor < next_symbol_idx;
+               struct_lexer.strip_white_space(struct_lexer.m_cursor))
+          {
+            fields.push(struct_lexer.get_word(struct_lexer.m_cursor));
+          }
+          LX_ASSERT(fields.m_len > 0, E::CONTROL_STRUCTURE_ERROR);
+
+          Token symbol{ Type::StructDef };
+          symbol.as.ext_sym.name = sym_name;
+          symbol.as.ext_sym.sig  = parse_sig(fields, m_arena, 0).second;
+          symbol.as.ext_sym.def  = Tokens{ m_arena };
+
+          m_cursor = next_symbol_idx;
+          m_lines += struct_lexer.m_lines;
+
+          m_tokens.push(symbol);
+          break;
+        }
+
         Lexer sig_lexer{ m_input, m_arena, m_cursor, next_symbol_idx };
         UT::Vec<UT::String> types{ m_arena };
         UT::String          type{};
@@ -720,10 +1020,14 @@ Lexer::run()
         // TODO: parse this
         // LX_FN_TRY(sig_lexer.match_operator('='));
 
+        // NOTE: The symbol, the library and then the attributes of the def
         sig_lexer();
         Tokens sym_defs{ m_arena };
-        sym_defs.push(sig_lexer.m_tokens.last()->as.tokens[0]);
-        sym_defs.push(sig_lexer.m_tokens.last()->as.tokens[1]);
+        for (Token def_token : sig_lexer.m_tokens.last()->as.tokens)
+        {
+          sym_defs.push(def_token);
+        }
+        LX_ASSERT(sym_defs.m_len >= 2, E::CONTROL_STRUCTURE_ERROR);
 
         Token symbol{ Type::ExtDef };
         symbol.as.ext_sym.name = sym_name;
@@ -782,6 +1086,7 @@ Lexer::run()
     }
   }
 
+  LX_ASSERT(groups.empty(), E::PARENTHESIS_UNBALANCED);
   return LX::E::OK;
 }
 
@@ -797,13 +1102,14 @@ Lexer::generate_event_report()
     {
       std::printf("[%s] %s\n", UT::SERROR, (char *)e.m_data);
 
-      // Find the line with the error
+      // Find the line with the error, counted from the start of the input so
+      // that lexers of a part of it report the same line
       size_t line       = 1;
-      size_t line_begin = this->m_begin;
+      size_t line_begin = 0;
       size_t line_end   = this->m_end;
 
       // Locate the start of the line
-      for (size_t i = this->m_begin; i < this->m_end; ++i)
+      for (size_t i = 0; i < this->m_end; ++i)
       {
         if (this->m_input[i] == '\n')
         {
@@ -892,18 +1198,10 @@ void
 Lexer::strip_white_space(
   size_t idx)
 {
-  char   c         = this->m_input[idx];
-  size_t new_lines = 0;
-
-  while (is_white_space(c))
-  {
-    if ('\n' == c) new_lines += 1;
-    idx += 1;
-    c = this->m_input[idx];
-  }
+  size_t end = scan<Scan::WhiteSpace>(this->m_input, idx);
 
-  this->m_lines += new_lines;
-  this->m_cursor = idx;
+  this->m_lines += std::count(this->m_input + idx, this->m_input + end, '\n');
+  this->m_cursor = end;
 };
 
 // TODO: candidate for refactor
@@ -911,25 +1209,27 @@ void
 Lexer::strip_line(
   size_t idx)
 {
-  char c = this->m_input[idx];
-
-  while (c && '\n' != c)
-  {
-    idx += 1;
-    c = this->m_input[idx];
-  }
-
   this->m_lines += 1;
-  this->m_cursor = idx;
+  this->m_cursor = scan<Scan::Line>(this->m_input, idx);
 }
 
-void
-Lexer::push_group(
-  Lexer l)
+bool
+Lexer::close_group(
+  std::vector<size_t> &groups)
 {
-  Token t{ l.m_tokens };
-  this->m_tokens.push(t);
-  this->m_cursor = l.m_cursor + 1;
+  if (groups.empty()) return false;
+
+  size_t begin = groups.back();
+  groups.pop_back();
+
+  Tokens group{ this->m_arena };
+  for (size_t i = begin; i < this->m_tokens.m_len; ++i)
+  {
+    group.push(this->m_tokens[i]);
+  }
+  this->m_tokens.m_len = begin;
+  this->m_tokens.push(Token{ group });
+  return true;
 }
 
 char
@@ -938,41 +1238,71 @@ Lexer::peek_char()
   return this->m_cursor < this->m_end ? this->m_input[this->m_cursor] : '\0';
 }
 
-// TODO: candidate for refactor
-LX::E
-Lexer::find_next_global_symbol(
-  size_t &idx)
+void
+Lexer::index_defs()
 {
-  Lexer search_lexer{
-    this->m_input, this->m_arena, this->m_cursor, this->m_end
-  };
+  this->m_def_offsets.clear();
+  this->m_indexed = true;
+
+  const char *input = this->m_input;
+  size_t      end   = this->m_end;
 
-  for (UT::String next_word = search_lexer.get_word(this->m_cursor);
-       search_lexer.m_cursor < search_lexer.m_end;
-       next_word = search_lexer.get_word(search_lexer.m_cursor))
+  bool word_begins = true; // NOTE: the char before idx delimits a word
+  for (size_t idx = this->m_begin; idx < end; ++idx)
   {
-    // FIXME: lexer .get_word method should be aware of comments '#'
-    if ("#" == next_word)
+    char c = input[idx];
+    if ('#' == c)
     {
-      search_lexer.strip_line(search_lexer.m_cursor);
+      idx         = std::min(scan<Scan::Line>(input, idx + 1), end) - 1;
+      word_begins = true;
+      continue;
     }
-    if (delimits_word(search_lexer.m_input[search_lexer.m_cursor]))
+    if ('"' == c)
     {
-      search_lexer.m_cursor += 1;
+      idx         = std::min(scan<Scan::Quote>(input, idx + 1), end);
+      word_begins = true;
+      continue;
     }
-    if ("int" == next_word || "pub" == next_word || "ext" == next_word)
+    if (is_white_space(c))
+    {
+      idx         = std::min(scan<Scan::WhiteSpace>(input, idx), end) - 1;
+      word_begins = true;
+      continue;
+    }
+
+    size_t word_end = idx + 3;
+    if (word_begins && word_end <= end
+        && (word_end == end || delimits_word(input[word_end])))
     {
-      /*
-         Need to return the cursor just before
-         ..int...
-          ^    ^
-      */
-      idx = search_lexer.m_cursor - 3 - 1;
-      return E::OK;
+      UT::String word{ input + idx, 3 };
+      if (this->match_keyword(Keyword::INT, word)
+          || this->match_keyword(Keyword::PUB, word)
+          || this->match_keyword(Keyword::EXT, word))
+      {
+        this->m_def_offsets.push_back(idx);
+      }
     }
+
+    word_begins = delimits_word(c);
+    if (word_begins) continue;
+
+    // NOTE: Only the bytes that end the word matter until then
+    idx = std::min(scan<Scan::Name>(input, idx + 1), end) - 1;
   }
+}
+
+LX::E
+Lexer::find_next_global_symbol(
+  size_t &idx)
+{
+  if (!this->m_indexed) this->index_defs();
+
+  auto next = std::upper_bound(
+    this->m_def_offsets.begin(), this->m_def_offsets.end(), this->m_cursor);
+  if (this->m_def_offsets.end() == next) return E::WORD_NOT_FOUND;
 
-  return E::WORD_NOT_FOUND;
+  idx = *next;
+  return E::OK;
 }
 
 Lexer::Lexer(
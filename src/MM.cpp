@@ -0,0 +1,296 @@
+/*-------------------------------------------------------------------------------
+ *\file MM.cpp
+ *\info Purity analysis and memo table impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "MM.hpp"
+#include "EX.hpp"
+#include "TL.hpp"
+#include "UT.hpp"
+#include <vector>
+
+namespace MM
+{
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+bool
+is_bound(
+  const std::vector<UT::String> &bound, UT::String name)
+{
+  for (UT::String binding : bound)
+  {
+    if (UT::strcompare(binding, name)) return true;
+  }
+  return false;
+}
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Purity)
+ *------------------------------------------------------------------------------*/
+
+bool
+Purity::analyse(
+  UT::String name, const EX::Expr &expr)
+{
+  std::vector<UT::String> bound{};
+
+  bool is_pure = this->pure(expr, bound, name);
+  this->m_pure[UT::symbol(name)] = is_pure;
+
+  return is_pure;
+}
+
+bool
+Purity::is_pure(
+  UT::String name) const
+{
+  auto it = this->m_pure.find(UT::symbol(name));
+  return this->m_pure.end() != it && it->second;
+}
+
+bool
+Purity::pure_global(
+  UT::String name, UT::String self)
+{
+  if (UT::strcompare(name, self)) return true;
+  if (TL::find_foreign(name)) return false;
+
+  // NOTE: Defs that are not known yet are assumed to do anything
+  return this->is_pure(name);
+}
+
+bool
+Purity::pure_exprs(
+  const EX::Exprs &exprs, std::vector<UT::String> &bound, UT::String self)
+{
+  for (const EX::Expr &expr : exprs)
+  {
+    if (!this->pure(expr, bound, self)) return false;
+  }
+  return true;
+}
+
+bool
+Purity::pure(
+  const EX::Expr &expr, std::vector<UT::String> &bound, UT::String self)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while analysing (%s)",
+                UT_TCS(expr.m_type));
+  }
+
+  switch (expr.m_type)
+  {
+  case EX::Type::Int: return true;
+  case EX::Type::Str:
+  case EX::Type::While:
+  case EX::Type::Unknown: return false;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    return this->pure(pair.first(), bound, self)
+           && this->pure(pair.second(), bound, self);
+  }
+  case EX::Type::Minus:
+  case EX::Type::Not  : return this->pure(*expr.as.m_expr, bound, self);
+  case EX::Type::If:
+  {
+    return this->pure(*expr.as.m_if.m_condition, bound, self)
+           && this->pure(*expr.as.m_if.m_true_branch, bound, self)
+           && this->pure(*expr.as.m_if.m_else_branch, bound, self);
+  }
+  case EX::Type::Var:
+  {
+    return is_bound(bound, expr.as.m_var)
+           || this->pure_global(expr.as.m_var, self);
+  }
+  case EX::Type::Let:
+  {
+    if (!this->pure(*expr.as.m_let.m_value, bound, self)) return false;
+
+    bound.push_back(expr.as.m_let.m_var_name);
+    bool is_pure = this->pure(*expr.as.m_let.m_continuation, bound, self);
+    bound.pop_back();
+
+    return is_pure;
+  }
+  case EX::Type::FnDef:
+  {
+    bound.push_back(expr.as.m_fn.m_param);
+    bool is_pure = this->pure(*expr.as.m_fn.m_body, bound, self);
+    bound.pop_back();
+
+    return is_pure;
+  }
+  case EX::Type::FnApp:
+  {
+    const EX::FnApp &fnapp = expr.as.m_fnapp;
+    if (!this->pure_exprs(fnapp.m_param, bound, self)) return false;
+
+    bound.push_back(fnapp.m_body.m_param);
+    bool is_pure = this->pure(*fnapp.m_body.m_body, bound, self);
+    bound.pop_back();
+
+    return is_pure;
+  }
+  case EX::Type::VarApp:
+  {
+    const EX::VarApp &varapp = expr.as.m_varapp;
+    if (is_bound(bound, varapp.m_fn_name)) return false;
+
+    return this->pure_global(varapp.m_fn_name, self)
+           && this->pure_exprs(varapp.m_param, bound, self);
+  }
+  }
+
+  UT_FAIL_IF("UNREACHABLE");
+  return false;
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Memo)
+ *------------------------------------------------------------------------------*/
+
+bool
+Memo::Key::operator==(
+  const Key &other) const
+{
+  if (this->m_fn != other.m_fn || this->m_argc != other.m_argc) return false;
+  for (size_t i = 0; i < this->m_argc; ++i)
+  {
+    if (this->m_args[i] != other.m_args[i]) return false;
+  }
+  return true;
+}
+
+size_t
+Memo::KeyHash::operator()(
+  const Key &key) const
+{
+  size_t hash = std::hash<const void *>{}(key.m_fn);
+  for (size_t i = 0; i < key.m_argc; ++i)
+  {
+    hash ^= std::hash<ssize_t>{}(key.m_args[i]) + 0x9e3779b9 + (hash << 6)
+            + (hash >> 2);
+  }
+  return hash;
+}
+
+Memo::Memo(
+  size_t limit)
+    : m_limit{ limit },
+      m_stats{}
+{
+}
+
+Memo::Key
+Memo::make_key(
+  const void *fn, const ssize_t *args, size_t argc)
+{
+  Key key{};
+  key.m_fn   = fn;
+  key.m_argc = argc;
+  for (size_t i = 0; i < argc; ++i) key.m_args[i] = args[i];
+  return key;
+}
+
+bool
+Memo::find(
+  const void *fn, const ssize_t *args, size_t argc, ssize_t &result)
+{
+  if (argc > MAX_ARGS) return false;
+
+  auto it = this->m_index.find(make_key(fn, args, argc));
+  if (this->m_index.end() == it)
+  {
+    this->m_stats.m_misses += 1;
+    return false;
+  }
+
+  this->m_entries.splice(this->m_entries.begin(), this->m_entries, it->second);
+  this->m_stats.m_hits += 1;
+  result = it->second->second;
+
+  return true;
+}
+
+void
+Memo::insert(
+  const void *fn, const ssize_t *args, size_t argc, ssize_t result)
+{
+  if (argc > MAX_ARGS || 0 == this->m_limit) return;
+
+  Key  key = make_key(fn, args, argc);
+  auto it  = this->m_index.find(key);
+  if (this->m_index.end() != it)
+  {
+    it->second->second = result;
+    this->m_entries.splice(this->m_entries.begin(), this->m_entries, it->second);
+    return;
+  }
+
+  if (this->m_entries.size() >= this->m_limit)
+  {
+    this->m_index.erase(this->m_entries.back().first);
+    this->m_entries.pop_back();
+    this->m_stats.m_evictions += 1;
+  }
+
+  this->m_entries.emplace_front(key, result);
+  this->m_index[key] = this->m_entries.begin();
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (MM)
+ *------------------------------------------------------------------------------*/
+
+bool
+calls_self_in_tail(
+  UT::String name, const EX::Expr &expr)
+{
+  switch (expr.m_type)
+  {
+  case EX::Type::FnDef: return calls_self_in_tail(name, *expr.as.m_fn.m_body);
+  case EX::Type::Let:
+  {
+    return calls_self_in_tail(name, *expr.as.m_let.m_continuation);
+  }
+  case EX::Type::If:
+  {
+    return calls_self_in_tail(name, *expr.as.m_if.m_true_branch)
+           || calls_self_in_tail(name, *expr.as.m_if.m_else_branch);
+  }
+  case EX::Type::FnApp:
+  {
+    return calls_self_in_tail(name, *expr.as.m_fnapp.m_body.m_body);
+  }
+  case EX::Type::VarApp:
+  {
+    return UT::strcompare(name, expr.as.m_varapp.m_fn_name);
+  }
+  default: return false;
+  }
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace MM
@@ -0,0 +1,361 @@
+/*-------------------------------------------------------------------------------
+ *\file OP.cpp
+ *\info Constant folding pass impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "OP.hpp"
+#include "EX.hpp"
+#include "UT.hpp"
+#include <climits>
+#include <vector>
+
+namespace OP
+{
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+bool
+is_bound(
+  const std::vector<UT::String> &bound, UT::String name)
+{
+  for (UT::String binding : bound)
+  {
+    if (UT::strcompare(binding, name)) return true;
+  }
+  return false;
+}
+
+EX::Expr
+make_int(
+  ssize_t value)
+{
+  EX::Expr expr{ EX::Type::Int };
+  expr.as.m_int = value;
+  return expr;
+}
+
+// NOTE: A let inside of a loop rebinds its variable for the next iteration,
+// so every name let anywhere in the body counts as bound in the whole loop
+void
+collect_let_names(
+  const EX::Expr &expr, std::vector<UT::String> &names)
+{
+  switch (expr.m_type)
+  {
+  case EX::Type::Let:
+  {
+    names.push_back(expr.as.m_let.m_var_name);
+    collect_let_names(*expr.as.m_let.m_value, names);
+    collect_let_names(*expr.as.m_let.m_continuation, names);
+  }
+  break;
+  case EX::Type::If:
+  {
+    collect_let_names(*expr.as.m_if.m_condition, names);
+    collect_let_names(*expr.as.m_if.m_true_branch, names);
+    collect_let_names(*expr.as.m_if.m_else_branch, names);
+  }
+  break;
+  case EX::Type::While:
+  {
+    collect_let_names(*expr.as.m_while.m_condition, names);
+    collect_let_names(*expr.as.m_while.m_body, names);
+  }
+  break;
+  case EX::Type::Minus:
+  case EX::Type::Not  : collect_let_names(*expr.as.m_expr, names); break;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    collect_let_names(pair.first(), names);
+    collect_let_names(pair.second(), names);
+  }
+  break;
+  default: break;
+  }
+}
+
+// NOTE: Folds are done on unsigned words so that overflow wraps like it does
+// at runtime instead of being undefined in the compiler
+bool
+fold_bin_op(
+  EX::Type type, ssize_t left, ssize_t right, ssize_t &result)
+{
+  switch (type)
+  {
+  case EX::Type::Add : result = (ssize_t)((size_t)left + (size_t)right); break;
+  case EX::Type::Sub : result = (ssize_t)((size_t)left - (size_t)right); break;
+  case EX::Type::Mult: result = (ssize_t)((size_t)left * (size_t)right); break;
+  case EX::Type::IsEq: result = left == right; break;
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  {
+    // NOTE: These trap at runtime, so they are left for the runtime to do
+    if (0 == right || (LONG_MIN == left && -1 == right)) return false;
+    result = EX::Type::Div == type ? left / right : left % right;
+  }
+  break;
+  default: UT_FAIL_MSG("UNREACHABLE type = %s", UT_TCS(type));
+  }
+  return true;
+}
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Folder)
+ *------------------------------------------------------------------------------*/
+
+void
+Folder::declare(
+  UT::String name)
+{
+  this->m_defined[UT::symbol(name)] += 1;
+}
+
+size_t
+Folder::run(
+  UT::String name, EX::Expr &expr)
+{
+  size_t before = count_nodes(expr);
+
+  std::vector<UT::String> bound{};
+  this->fold(expr, bound);
+
+  UT::Sym key = UT::symbol(name);
+  if (EX::Type::Int == expr.m_type && 1 == this->m_defined[key])
+  {
+    this->m_constants[key] = expr.as.m_int;
+  }
+
+  return before - count_nodes(expr);
+}
+
+void
+Folder::fold_exprs(
+  EX::Exprs &exprs, std::vector<UT::String> &bound)
+{
+  for (EX::Expr &expr : exprs) this->fold(expr, bound);
+}
+
+void
+Folder::fold(
+  EX::Expr &expr, std::vector<UT::String> &bound)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while folding (%s)",
+                UT_TCS(expr.m_type));
+  }
+
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str:
+  case EX::Type::Unknown: break;
+  case EX::Type::Var:
+  {
+    UT::String name = expr.as.m_var;
+    if (is_bound(bound, name)) break;
+
+    auto it = this->m_constants.find(UT::symbol(name));
+    if (this->m_constants.end() != it) expr = make_int(it->second);
+  }
+  break;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    EX::Expr *left  = expr.as.m_pair.begin();
+    EX::Expr *right = expr.as.m_pair.last();
+    this->fold(*left, bound);
+    this->fold(*right, bound);
+
+    ssize_t result = 0;
+    if (EX::Type::Int == left->m_type && EX::Type::Int == right->m_type
+        && fold_bin_op(expr.m_type, left->as.m_int, right->as.m_int, result))
+    {
+      expr = make_int(result);
+    }
+  }
+  break;
+  case EX::Type::Minus:
+  {
+    this->fold(*expr.as.m_expr, bound);
+    if (EX::Type::Int == expr.as.m_expr->m_type)
+    {
+      expr = make_int((ssize_t)(0 - (size_t)expr.as.m_expr->as.m_int));
+    }
+  }
+  break;
+  case EX::Type::Not:
+  {
+    this->fold(*expr.as.m_expr, bound);
+    if (EX::Type::Int == expr.as.m_expr->m_type)
+    {
+      expr = make_int(!expr.as.m_expr->as.m_int);
+    }
+  }
+  break;
+  case EX::Type::If:
+  {
+    EX::If &if_else = expr.as.m_if;
+    this->fold(*if_else.m_condition, bound);
+    this->fold(*if_else.m_true_branch, bound);
+    this->fold(*if_else.m_else_branch, bound);
+
+    if (EX::Type::Int == if_else.m_condition->m_type)
+    {
+      expr = if_else.m_condition->as.m_int ? *if_else.m_true_branch
+                                           : *if_else.m_else_branch;
+    }
+  }
+  break;
+  case EX::Type::Let:
+  {
+    EX::Let &let = expr.as.m_let;
+    this->fold(*let.m_value, bound);
+
+    bound.push_back(let.m_var_name);
+    this->fold(*let.m_continuation, bound);
+    bound.pop_back();
+  }
+  break;
+  case EX::Type::While:
+  {
+    size_t len = bound.size();
+    collect_let_names(expr, bound);
+
+    this->fold(*expr.as.m_while.m_condition, bound);
+    this->fold(*expr.as.m_while.m_body, bound);
+
+    bound.resize(len);
+  }
+  break;
+  case EX::Type::FnDef:
+  {
+    bound.push_back(expr.as.m_fn.m_param);
+    this->fold(*expr.as.m_fn.m_body, bound);
+    bound.pop_back();
+  }
+  break;
+  case EX::Type::FnApp:
+  {
+    EX::FnApp &fnapp = expr.as.m_fnapp;
+    this->fold_exprs(fnapp.m_param, bound);
+
+    // NOTE: The params of the lambda chain are bound one after the other
+    size_t    len   = bound.size();
+    EX::FnDef layer = fnapp.m_body;
+    for (size_t i = 0; i < fnapp.m_param.m_len; ++i)
+    {
+      bound.push_back(layer.m_param);
+      if (EX::Type::FnDef != layer.m_body->m_type) break;
+      layer = layer.m_body->as.m_fn;
+    }
+    this->fold(*fnapp.m_body.m_body, bound);
+    bound.resize(len);
+  }
+  break;
+  case EX::Type::VarApp:
+  {
+    this->fold_exprs(expr.as.m_varapp.m_param, bound);
+  }
+  break;
+  }
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (OP)
+ *------------------------------------------------------------------------------*/
+
+size_t
+count_nodes(
+  const EX::Expr &expr)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while counting (%s)",
+                UT_TCS(expr.m_type));
+  }
+
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str:
+  case EX::Type::Var:
+  case EX::Type::Unknown: return 1;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    return 1 + count_nodes(pair.first()) + count_nodes(pair.second());
+  }
+  case EX::Type::Minus:
+  case EX::Type::Not  : return 1 + count_nodes(*expr.as.m_expr);
+  case EX::Type::If:
+  {
+    return 1 + count_nodes(*expr.as.m_if.m_condition)
+           + count_nodes(*expr.as.m_if.m_true_branch)
+           + count_nodes(*expr.as.m_if.m_else_branch);
+  }
+  case EX::Type::Let:
+  {
+    return 1 + count_nodes(*expr.as.m_let.m_value)
+           + count_nodes(*expr.as.m_let.m_continuation);
+  }
+  case EX::Type::While:
+  {
+    return 1 + count_nodes(*expr.as.m_while.m_condition)
+           + count_nodes(*expr.as.m_while.m_body);
+  }
+  case EX::Type::FnDef: return 1 + count_nodes(*expr.as.m_fn.m_body);
+  case EX::Type::FnApp:
+  {
+    size_t count = 1 + count_nodes(*expr.as.m_fnapp.m_body.m_body);
+    for (const EX::Expr &param : expr.as.m_fnapp.m_param)
+    {
+      count += count_nodes(param);
+    }
+    return count;
+  }
+  case EX::Type::VarApp:
+  {
+    size_t count = 1;
+    for (const EX::Expr &param : expr.as.m_varapp.m_param)
+    {
+      count += count_nodes(param);
+    }
+    return count;
+  }
+  }
+
+  UT_FAIL_IF("UNREACHABLE");
+  return 0;
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace OP
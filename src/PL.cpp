@@ -0,0 +1,336 @@
+/*-------------------------------------------------------------------------------
+ *\file PL.cpp
+ *\info Dependency graph and worker pool impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "PL.hpp"
+#include "UT.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace PL
+{
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+// NOTE: The pool the current thread works for and the index of its deque
+thread_local const Pool *current_pool   = nullptr;
+thread_local size_t      current_worker = 0;
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Graph)
+ *------------------------------------------------------------------------------*/
+
+size_t
+Graph::add()
+{
+  this->m_dependents.emplace_back();
+  this->m_blockers.push_back(0);
+  return this->m_blockers.size() - 1;
+}
+
+void
+Graph::depend(
+  size_t task, size_t on)
+{
+  UT_FAIL_IF(on >= task);
+
+  this->m_dependents[on].push_back(task);
+  this->m_blockers[task] += 1;
+}
+
+size_t
+Graph::size() const
+{
+  return this->m_blockers.size();
+}
+
+void
+Graph::run(
+  size_t workers, const Task &task)
+{
+  size_t len = this->size();
+  if (workers > len) workers = len;
+
+  if (workers <= 1)
+  {
+    for (size_t i = 0; i < len; ++i) task(i, 0);
+    return;
+  }
+
+  std::mutex              mutex{};
+  std::condition_variable changed{};
+  std::set<size_t>        ready{};
+  std::vector<size_t>     blockers = this->m_blockers;
+  size_t                  done     = 0;
+
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (!blockers[i]) ready.insert(i);
+  }
+
+  auto work = [&](size_t worker) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    for (;;)
+    {
+      changed.wait(lock, [&] { return !ready.empty() || done == len; });
+      if (done == len) return;
+
+      // NOTE: The earliest ready task first, so that defs roughly keep the
+      // order of the source
+      size_t next = *ready.begin();
+      ready.erase(ready.begin());
+
+      lock.unlock();
+      task(next, worker);
+      lock.lock();
+
+      for (size_t dependent : this->m_dependents[next])
+      {
+        if (0 == --blockers[dependent]) ready.insert(dependent);
+      }
+      done += 1;
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads{};
+  for (size_t i = 1; i < workers; ++i) threads.emplace_back(work, i);
+  work(0);
+  for (std::thread &thread : threads) thread.join();
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Pool)
+ *------------------------------------------------------------------------------*/
+
+Pool::Pool(
+  size_t workers)
+    : m_stop{ false },
+      m_queued{ 0 }
+{
+  if (!workers) workers = 1;
+
+  for (size_t i = 0; i < workers; ++i)
+  {
+    this->m_deques.push_back(std::make_unique<Deque>());
+  }
+  for (size_t i = 1; i < workers; ++i)
+  {
+    this->m_threads.emplace_back(&Pool::work, this, i);
+  }
+}
+
+Pool::~Pool()
+{
+  {
+    std::lock_guard<std::mutex> lock{ this->m_idle_mutex };
+    this->m_stop = true;
+  }
+  this->m_idle.notify_all();
+  for (std::thread &thread : this->m_threads) thread.join();
+}
+
+Pool::Task *
+Pool::steal(
+  size_t worker)
+{
+  size_t len = this->m_deques.size();
+  for (size_t i = 0; i < len; ++i)
+  {
+    Deque                      &victim = *this->m_deques[(worker + i) % len];
+    std::lock_guard<std::mutex> lock{ victim.m_mutex };
+    if (victim.m_tasks.empty()) continue;
+
+    Task *task = victim.m_tasks.front();
+    victim.m_tasks.pop_front();
+    this->m_queued -= 1;
+    return task;
+  }
+  return nullptr;
+}
+
+void
+Pool::work(
+  size_t worker)
+{
+  current_pool   = this;
+  current_worker = worker;
+
+  while (!this->m_stop)
+  {
+    Task *task = this->steal(worker);
+    if (task)
+    {
+      (*task->m_fn)();
+      task->m_done.store(true, std::memory_order_release);
+      continue;
+    }
+
+    // NOTE: The timeout covers a task queued right before the wait
+    std::unique_lock<std::mutex> lock{ this->m_idle_mutex };
+    this->m_idle.wait_for(lock, std::chrono::milliseconds(1), [&] {
+      return this->m_stop || this->m_queued > 0;
+    });
+  }
+}
+
+void
+Pool::fork_join(
+  const Fn &left, const Fn &right)
+{
+  size_t worker = this == current_pool ? current_worker : 0;
+  Deque &deque  = *this->m_deques[worker];
+
+  Task task{ &right, { false } };
+  {
+    std::lock_guard<std::mutex> lock{ deque.m_mutex };
+    deque.m_tasks.push_back(&task);
+  }
+  this->m_queued += 1;
+  this->m_idle.notify_one();
+
+  left();
+
+  bool stolen = true;
+  {
+    std::lock_guard<std::mutex> lock{ deque.m_mutex };
+    if (!deque.m_tasks.empty() && &task == deque.m_tasks.back())
+    {
+      deque.m_tasks.pop_back();
+      stolen = false;
+    }
+  }
+
+  if (!stolen)
+  {
+    this->m_queued -= 1;
+    right();
+    return;
+  }
+
+  // NOTE: Help out with other tasks until the thief is done with this one
+  while (!task.m_done.load(std::memory_order_acquire))
+  {
+    Task *other = this->steal(worker);
+    if (!other)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    (*other->m_fn)();
+    other->m_done.store(true, std::memory_order_release);
+  }
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Jobs)
+ *------------------------------------------------------------------------------*/
+
+Jobs::Jobs(
+  size_t workers)
+    : m_next{ 0 },
+      m_stop{ false }
+{
+  if (!workers) workers = 1;
+
+  for (size_t i = 0; i < workers; ++i)
+  {
+    this->m_threads.emplace_back(&Jobs::work, this);
+  }
+}
+
+Jobs::~Jobs()
+{
+  {
+    std::lock_guard<std::mutex> lock{ this->m_mutex };
+    this->m_stop = true;
+  }
+  this->m_posted.notify_all();
+  for (std::thread &thread : this->m_threads) thread.join();
+}
+
+size_t
+Jobs::post(
+  Job job)
+{
+  size_t ticket = 0;
+  {
+    std::lock_guard<std::mutex> lock{ this->m_mutex };
+    ticket = this->m_slots.size();
+    this->m_slots.push_back(Slot{ std::move(job), 0, false });
+  }
+  this->m_posted.notify_one();
+  return ticket;
+}
+
+ssize_t
+Jobs::wait(
+  size_t ticket)
+{
+  std::unique_lock<std::mutex> lock{ this->m_mutex };
+  UT_FAIL_IF(ticket >= this->m_slots.size());
+
+  Slot &slot = this->m_slots[ticket];
+  this->m_finished.wait(lock, [&] { return slot.m_done; });
+  return slot.m_result;
+}
+
+void
+Jobs::work()
+{
+  std::unique_lock<std::mutex> lock{ this->m_mutex };
+  for (;;)
+  {
+    this->m_posted.wait(lock, [&] {
+      return this->m_stop || this->m_next < this->m_slots.size();
+    });
+    if (this->m_next == this->m_slots.size()) return;
+
+    // NOTE: The deque only grows at the back, so slot stays where it is
+    Slot &slot = this->m_slots[this->m_next++];
+    Job   job  = std::move(slot.m_job);
+
+    lock.unlock();
+    ssize_t result = job();
+    lock.lock();
+
+    slot.m_result = result;
+    slot.m_done   = true;
+    this->m_finished.notify_all();
+  }
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (PL)
+ *------------------------------------------------------------------------------*/
+
+size_t
+workers(
+  size_t wanted)
+{
+  if (wanted) return wanted;
+
+  size_t cores = std::thread::hardware_concurrency();
+  return cores ? cores : 1;
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace PL
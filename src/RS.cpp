@@ -0,0 +1,908 @@
+/*-------------------------------------------------------------------------------
+ *\file RS.cpp
+ *\info Resolver and frame runtime impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "RS.hpp"
+#include "EX.hpp"
+#include "JT.hpp"
+#include "MM.hpp"
+#include "TL.hpp"
+#include "UT.hpp"
+#include <vector>
+
+namespace RS
+{
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+Node *
+make_node(
+  AR::Arena &arena, Op op)
+{
+  Node *node = (Node *)arena.alloc<Node>();
+  new (node) Node{ op };
+  return node;
+}
+
+Op
+bin_op(
+  EX::Type type)
+{
+  switch (type)
+  {
+  case EX::Type::Add    : return Op::Add;
+  case EX::Type::Sub    : return Op::Sub;
+  case EX::Type::Mult   : return Op::Mult;
+  case EX::Type::Div    : return Op::Div;
+  case EX::Type::Modulus: return Op::Modulus;
+  case EX::Type::IsEq   : return Op::IsEq;
+  default               : UT_FAIL_MSG("UNREACHABLE type = %s", UT_TCS(type));
+  }
+  return Op::Add;
+}
+
+// NOTE: collects the names of the lets that sit on the spine of expr
+void
+collect_spine_names(
+  const EX::Expr &expr, std::vector<UT::String> &names)
+{
+  switch (expr.m_type)
+  {
+  case EX::Type::Let:
+  {
+    names.push_back(expr.as.m_let.m_var_name);
+    collect_spine_names(*expr.as.m_let.m_continuation, names);
+  }
+  break;
+  case EX::Type::If:
+  {
+    collect_spine_names(*expr.as.m_if.m_true_branch, names);
+    collect_spine_names(*expr.as.m_if.m_else_branch, names);
+  }
+  break;
+  case EX::Type::Minus:
+  case EX::Type::Not  : collect_spine_names(*expr.as.m_expr, names); break;
+  default             : break;
+  }
+}
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Value)
+ *------------------------------------------------------------------------------*/
+
+Value::Value(
+  ssize_t integer)
+    : m_kind{ Kind::Int }
+{
+  this->as.m_int = integer;
+}
+
+Value::Value(
+  UT::String string)
+    : m_kind{ Kind::Str }
+{
+  this->as.m_string = string;
+}
+
+Value::Value(
+  Closure fn)
+    : m_kind{ Kind::Fn }
+{
+  this->as.m_fn = fn;
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Globals)
+ *------------------------------------------------------------------------------*/
+
+bool
+Globals::find(
+  UT::String name, uint32_t &slot)
+{
+  auto it = this->m_slots.find(UT::symbol(name));
+  if (this->m_slots.end() == it) return false;
+
+  slot = it->second;
+  return true;
+}
+
+uint32_t
+Globals::slot(
+  UT::String name)
+{
+  uint32_t slot = 0;
+  if (this->find(name, slot)) return slot;
+
+  slot = this->m_names.size();
+  this->m_slots[UT::symbol(name)] = slot;
+  this->m_names.push_back(name);
+  this->m_values.push_back(Value{});
+  this->m_defined.push_back(false);
+
+  return slot;
+}
+
+void
+Globals::define(
+  UT::String name, Value value)
+{
+  uint32_t slot = this->slot(name);
+
+  // NOTE: Native code calls itself directly, which is only right for as long
+  // as the slot it was compiled against is not redefined
+  if (this->m_defined[slot] && Kind::Fn == this->m_values[slot].m_kind)
+  {
+    this->m_values[slot].as.m_fn.m_proto->m_native = nullptr;
+  }
+
+  this->m_values[slot]  = value;
+  this->m_defined[slot] = true;
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Resolver)
+ *------------------------------------------------------------------------------*/
+
+Resolver::Resolver(
+  AR::Arena &arena, Globals &globals)
+    : m_arena{ arena },
+      m_globals{ globals }
+{
+}
+
+Proto *
+Resolver::resolve_def(
+  const EX::Expr &expr, UT::String name)
+{
+  Scope scope{ nullptr, {}, 0, false };
+
+  Proto *proto = (Proto *)this->m_arena.alloc<Proto>();
+  new (proto) Proto{};
+  proto->m_name     = name;
+  proto->m_arity    = 0;
+  proto->m_body     = this->resolve(expr, scope, false);
+  proto->m_captures = false;
+
+  proto->m_frame_len = scope.m_len;
+
+  return proto;
+}
+
+bool
+Resolver::lookup(
+  Scope &scope, UT::String name, Address &address)
+{
+  uint32_t depth = 0;
+  for (Scope *s = &scope; s; s = s->m_parent, ++depth)
+  {
+    for (size_t i = s->m_bindings.size(); i > 0; --i)
+    {
+      Binding &binding = s->m_bindings[i - 1];
+      if (UT::strcompare(binding.m_name, name))
+      {
+        address = { depth, binding.m_slot };
+
+        // NOTE: every frame between the use and the definition has to keep
+        // a link to its parent alive
+        Scope *capturing = &scope;
+        for (uint32_t d = 0; d < depth; ++d)
+        {
+          capturing->m_captures = true;
+          capturing             = capturing->m_parent;
+        }
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+Node *
+Resolver::resolve_var(
+  UT::String name, Scope &scope)
+{
+  Address address{};
+  if (this->lookup(scope, name, address))
+  {
+    Node *node       = make_node(this->m_arena, Op::Local);
+    node->as.m_local = address;
+    return node;
+  }
+
+  uint32_t slot = 0;
+  if (this->m_globals.find(name, slot))
+  {
+    Node *node        = make_node(this->m_arena, Op::Global);
+    node->as.m_global = slot;
+    return node;
+  }
+
+  TL::DFN *foreign_fn = TL::find_foreign(name);
+  if (foreign_fn)
+  {
+    Node *node                = make_node(this->m_arena, Op::ForeignCall);
+    node->as.m_foreign.m_fn   = foreign_fn;
+    node->as.m_foreign.m_args = nullptr;
+    node->as.m_foreign.m_argc = 0;
+    return node;
+  }
+
+  // NOTE: Defined later in the module, the slot is filled when it is
+  Node *node        = make_node(this->m_arena, Op::Global);
+  node->as.m_global = this->m_globals.slot(name);
+  return node;
+}
+
+Node **
+Resolver::resolve_args(
+  const EX::Exprs &params, Scope &scope)
+{
+  Node **args = (Node **)this->m_arena.alloc<Node *>(params.m_len);
+  for (size_t i = 0; i < params.m_len; ++i)
+  {
+    args[i] = this->resolve(params[i], scope, false);
+  }
+  return args;
+}
+
+Node *
+Resolver::resolve_app(
+  UT::String name, const EX::Exprs &params, Scope &scope)
+{
+  Node *callee = this->resolve_var(name, scope);
+
+  if (Op::ForeignCall == callee->m_op)
+  {
+    TL::check_foreign_args(callee->as.m_foreign.m_fn, params.m_len);
+    callee->as.m_foreign.m_args = this->resolve_args(params, scope);
+    callee->as.m_foreign.m_argc = params.m_len;
+    return callee;
+  }
+
+  Node *node               = make_node(this->m_arena, Op::Call);
+  node->as.m_call.m_callee = callee;
+  node->as.m_call.m_args   = this->resolve_args(params, scope);
+  node->as.m_call.m_argc   = params.m_len;
+  return node;
+}
+
+Proto *
+Resolver::resolve_fn(
+  const EX::FnDef &fn, Scope *parent)
+{
+  Scope scope{ parent, {}, 0, false };
+
+  Proto *proto = (Proto *)this->m_arena.alloc<Proto>();
+  new (proto) Proto{};
+  proto->m_source = fn;
+  proto->m_name   = fn.m_param;
+  proto->m_arity  = 0;
+
+  // NOTE: \x = \y = body binds both x and y in the same frame
+  const EX::FnDef *layer = &fn;
+  for (;;)
+  {
+    scope.m_bindings.push_back({ layer->m_param, scope.m_len });
+    scope.m_len += 1;
+    proto->m_arity += 1;
+
+    if (EX::Type::FnDef != layer->m_body->m_type) break;
+    layer = &layer->m_body->as.m_fn;
+  }
+
+  proto->m_body      = this->resolve(*layer->m_body, scope, false);
+  proto->m_frame_len = scope.m_len;
+  proto->m_captures  = scope.m_captures;
+
+  return proto;
+}
+
+// NOTE: The reference evaluator hands the environment of the last evaluated
+// let back to a while loop, which is how loops carry state between
+// iterations. The spine is every position whose environment flows back that
+// way, lets on it rebind the visible variable instead of shadowing it.
+Node *
+Resolver::resolve(
+  const EX::Expr &expr, Scope &scope, bool spine)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while resolving (%s)",
+                UT_TCS(expr.m_type));
+  }
+
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  {
+    Node *node     = make_node(this->m_arena, Op::Int);
+    node->as.m_int = expr.as.m_int;
+    return node;
+  }
+  case EX::Type::Str:
+  {
+    Node *node        = make_node(this->m_arena, Op::Str);
+    node->as.m_string = expr.as.m_string;
+    return node;
+  }
+  case EX::Type::Var:
+  {
+    return this->resolve_var(expr.as.m_var, scope);
+  }
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+
+    Node *node            = make_node(this->m_arena, bin_op(expr.m_type));
+    node->as.m_bin.m_left = this->resolve(*pair.begin(), scope, false);
+    node->as.m_bin.m_right = this->resolve(*pair.last(), scope, false);
+    return node;
+  }
+  case EX::Type::Minus:
+  case EX::Type::Not:
+  {
+    Op    op   = EX::Type::Minus == expr.m_type ? Op::Minus : Op::Not;
+    Node *node = make_node(this->m_arena, op);
+    node->as.m_operand = this->resolve(*expr.as.m_expr, scope, spine);
+    return node;
+  }
+  case EX::Type::If:
+  {
+    Node *node = make_node(this->m_arena, Op::If);
+    node->as.m_if.m_condition
+      = this->resolve(*expr.as.m_if.m_condition, scope, false);
+    node->as.m_if.m_true_branch
+      = this->resolve(*expr.as.m_if.m_true_branch, scope, spine);
+    node->as.m_if.m_else_branch
+      = this->resolve(*expr.as.m_if.m_else_branch, scope, spine);
+    return node;
+  }
+  case EX::Type::Let:
+  {
+    const EX::Let &let = expr.as.m_let;
+
+    Node *node             = make_node(this->m_arena, Op::Let);
+    node->as.m_let.m_value = this->resolve(*let.m_value, scope, false);
+
+    Address target{};
+    if (spine && this->lookup(scope, let.m_var_name, target))
+    {
+      node->as.m_let.m_target = target;
+      node->as.m_let.m_continuation
+        = this->resolve(*let.m_continuation, scope, spine);
+      return node;
+    }
+
+    target = { 0, scope.m_len };
+    scope.m_len += 1;
+    scope.m_bindings.push_back({ let.m_var_name, target.m_slot });
+
+    node->as.m_let.m_target = target;
+    node->as.m_let.m_continuation
+      = this->resolve(*let.m_continuation, scope, spine);
+
+    scope.m_bindings.pop_back();
+    return node;
+  }
+  case EX::Type::While:
+  {
+    std::vector<UT::String> names{};
+    collect_spine_names(*expr.as.m_while.m_condition, names);
+    collect_spine_names(*expr.as.m_while.m_body, names);
+
+    std::vector<Address>  carried_from{};
+    std::vector<uint32_t> carried_to{};
+    size_t                bindings_len = scope.m_bindings.size();
+
+    for (UT::String name : names)
+    {
+      Address from{};
+      if (!this->lookup(scope, name, from)) continue;
+
+      bool is_carried = false;
+      for (size_t i = bindings_len; i < scope.m_bindings.size(); ++i)
+      {
+        is_carried |= UT::strcompare(scope.m_bindings[i].m_name, name);
+      }
+      if (is_carried) continue;
+
+      carried_from.push_back(from);
+      carried_to.push_back(scope.m_len);
+      scope.m_bindings.push_back({ name, scope.m_len });
+      scope.m_len += 1;
+    }
+
+    Node  *node  = make_node(this->m_arena, Op::While);
+    While &whyle = node->as.m_while;
+
+    whyle.m_carried_len = carried_from.size();
+    whyle.m_carried_from
+      = (Address *)this->m_arena.alloc<Address>(whyle.m_carried_len);
+    whyle.m_carried_to
+      = (uint32_t *)this->m_arena.alloc<uint32_t>(whyle.m_carried_len);
+    for (uint32_t i = 0; i < whyle.m_carried_len; ++i)
+    {
+      whyle.m_carried_from[i] = carried_from[i];
+      whyle.m_carried_to[i]   = carried_to[i];
+    }
+
+    whyle.m_condition
+      = this->resolve(*expr.as.m_while.m_condition, scope, true);
+    whyle.m_body = this->resolve(*expr.as.m_while.m_body, scope, true);
+
+    scope.m_bindings.resize(bindings_len);
+    return node;
+  }
+  case EX::Type::FnDef:
+  {
+    Node *node       = make_node(this->m_arena, Op::Lambda);
+    node->as.m_proto = this->resolve_fn(expr.as.m_fn, &scope);
+    return node;
+  }
+  case EX::Type::FnApp:
+  {
+    Node *callee       = make_node(this->m_arena, Op::Lambda);
+    callee->as.m_proto = this->resolve_fn(expr.as.m_fnapp.m_body, &scope);
+
+    Node *node               = make_node(this->m_arena, Op::Call);
+    node->as.m_call.m_callee = callee;
+    node->as.m_call.m_args = this->resolve_args(expr.as.m_fnapp.m_param, scope);
+    node->as.m_call.m_argc = expr.as.m_fnapp.m_param.m_len;
+    return node;
+  }
+  case EX::Type::VarApp:
+  {
+    return this->resolve_app(
+      expr.as.m_varapp.m_fn_name, expr.as.m_varapp.m_param, scope);
+  }
+  case EX::Type::Unknown:
+  default:
+  {
+    UT_FAIL_MSG("Type <%s> not supported yet\n", UT_TCS(expr.m_type));
+  }
+  break;
+  }
+
+  return nullptr;
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Runtime)
+ *------------------------------------------------------------------------------*/
+
+Runtime::Runtime(
+  AR::Arena &arena, Globals &globals)
+    : m_arena{ arena },
+      m_globals{ globals },
+      m_memo{ nullptr }
+{
+}
+
+Frame *
+Runtime::acquire(
+  uint32_t len, Frame *parent)
+{
+  Frame *frame = nullptr;
+
+  if (len < POOL_CLASSES && !this->m_pool[len].empty())
+  {
+    frame = this->m_pool[len].back();
+    this->m_pool[len].pop_back();
+  }
+  else
+  {
+    frame = (Frame *)this->m_arena.alloc(sizeof(Frame) + len * sizeof(Value));
+    frame->m_slots = (Value *)(frame + 1);
+    frame->m_len   = len;
+  }
+
+  frame->m_parent   = parent;
+  frame->m_bound    = 0;
+  frame->m_captured = false;
+
+  return frame;
+}
+
+void
+Runtime::release(
+  Frame *frame)
+{
+  if (frame->m_captured || frame->m_len >= POOL_CLASSES) return;
+  this->m_pool[frame->m_len].push_back(frame);
+}
+
+Value *
+Runtime::lookup(
+  Address address, Frame *frame)
+{
+  for (uint32_t depth = 0; depth < address.m_depth; ++depth)
+  {
+    frame = frame->m_parent;
+  }
+  return frame->m_slots + address.m_slot;
+}
+
+// NOTE: Calls of pure fns with integer args are looked up in the memo table,
+// on a miss the body is evaluated and an integer result is cached
+bool
+Runtime::memo_call(
+  const Proto &proto, Frame *frame, Value &result)
+{
+  if (!proto.m_memo || !this->m_memo || proto.m_arity > MM::MAX_ARGS)
+  {
+    return false;
+  }
+
+  ssize_t args[MM::MAX_ARGS];
+  for (uint32_t i = 0; i < proto.m_arity; ++i)
+  {
+    if (Kind::Int != frame->m_slots[i].m_kind) return false;
+    args[i] = frame->m_slots[i].as.m_int;
+  }
+
+  ssize_t cached = 0;
+  if (this->m_memo->find(&proto, args, proto.m_arity, cached))
+  {
+    result = Value{ cached };
+    return true;
+  }
+
+  result = this->eval(proto.m_body, frame);
+  if (Kind::Int == result.m_kind)
+  {
+    this->m_memo->insert(&proto, args, proto.m_arity, result.as.m_int);
+  }
+
+  return true;
+}
+
+Value
+Runtime::run(
+  const Proto &def)
+{
+  Frame *frame  = this->acquire(def.m_frame_len, nullptr);
+  Value  result = this->eval(def.m_body, frame);
+  this->release(frame);
+
+  return result;
+}
+
+Value
+Runtime::apply(
+  Value fn, Value *args, size_t argc)
+{
+  if (Kind::Fn != fn.m_kind)
+  {
+    UT_FAIL_MSG("Expected a function but found %s", UT_TCS(fn));
+  }
+
+  Closure      closure = fn.as.m_fn;
+  const Proto *proto   = closure.m_proto;
+  uint32_t     bound   = closure.m_partial ? closure.m_partial->m_bound : 0;
+
+  if (bound + argc < proto->m_arity)
+  {
+    Frame *partial      = this->acquire(proto->m_frame_len, closure.m_env);
+    partial->m_captured = true;
+    partial->m_bound    = bound + argc;
+    for (uint32_t i = 0; i < bound; ++i)
+    {
+      partial->m_slots[i] = closure.m_partial->m_slots[i];
+    }
+    for (size_t i = 0; i < argc; ++i)
+    {
+      partial->m_slots[bound + i] = args[i];
+    }
+
+    return Value{ Closure{ proto, closure.m_env, partial } };
+  }
+
+  size_t used  = proto->m_arity - bound;
+  Frame *frame = this->acquire(proto->m_frame_len, closure.m_env);
+  for (uint32_t i = 0; i < bound; ++i)
+  {
+    frame->m_slots[i] = closure.m_partial->m_slots[i];
+  }
+  for (size_t i = 0; i < used; ++i)
+  {
+    frame->m_slots[bound + i] = args[i];
+  }
+
+  Value result{};
+  if (!this->memo_call(*proto, frame, result))
+  {
+    result = this->eval(proto->m_body, frame);
+  }
+  this->release(frame);
+
+  if (used < argc)
+  {
+    return this->apply(result, args + used, argc - used);
+  }
+
+  return result;
+}
+
+ssize_t
+Runtime::eval_int(
+  const Node *node, Frame *frame)
+{
+  Value value = this->eval(node, frame);
+  if (Kind::Int != value.m_kind)
+  {
+    UT_FAIL_MSG("Expected an integer but found %s", UT_TCS(value));
+  }
+  return value.as.m_int;
+}
+
+Value
+Runtime::eval(
+  const Node *node, Frame *frame)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while evaluating (%s)",
+                UT_TCS(node->m_op));
+  }
+
+  // NOTE: Calls in tail position do not recurse, the callee frame replaces the
+  // current one and the body is evaluated by going around the loop. Frames
+  // acquired that way are owned here and released once the result is known.
+  Frame *owned = nullptr;
+
+  auto done = [&](Value result) {
+    if (owned) this->release(owned);
+    return result;
+  };
+
+  for (;;)
+  {
+    switch (node->m_op)
+    {
+    case Op::Int: return done(Value{ node->as.m_int });
+    case Op::Str: return done(Value{ node->as.m_string });
+    case Op::Local:
+    {
+      return done(*this->lookup(node->as.m_local, frame));
+    }
+    case Op::Global:
+    {
+      uint32_t slot = node->as.m_global;
+      if (!this->m_globals.m_defined[slot])
+      {
+        UT_FAIL_MSG("Variable (%s) is not defined",
+                    UT_TCS(this->m_globals.m_names[slot]));
+      }
+      return done(this->m_globals.m_values[slot]);
+    }
+    case Op::Lambda:
+    {
+      const Proto *proto = node->as.m_proto;
+      Frame       *env   = nullptr;
+      if (proto->m_captures)
+      {
+        frame->m_captured = true;
+        env               = frame;
+      }
+      return done(Value{ Closure{ proto, env, nullptr } });
+    }
+    case Op::Call:
+    {
+      const Call &call = node->as.m_call;
+      Value       fn   = this->eval(call.m_callee, frame);
+
+      if (Kind::Fn != fn.m_kind)
+      {
+        UT_FAIL_MSG("Expected a function but found %s", UT_TCS(fn));
+      }
+
+      const Closure &closure = fn.as.m_fn;
+      const Proto   *proto   = closure.m_proto;
+
+      // NOTE: The common case binds the params with a single slot write each
+      if (!closure.m_partial && call.m_argc == proto->m_arity)
+      {
+        Frame *callee_frame = this->acquire(proto->m_frame_len, closure.m_env);
+        for (uint32_t i = 0; i < call.m_argc; ++i)
+        {
+          callee_frame->m_slots[i] = this->eval(call.m_args[i], frame);
+        }
+
+        Value      result{};
+        JT::Native native
+          = JT::try_call(*proto, callee_frame->m_slots, call.m_argc, result);
+        if (JT::Native::Done == native
+            || this->memo_call(*proto, callee_frame, result))
+        {
+          this->release(callee_frame);
+          return done(result);
+        }
+
+        if (owned) this->release(owned);
+        owned = callee_frame;
+        frame = callee_frame;
+        node  = proto->m_body;
+        continue;
+      }
+
+      std::vector<Value> args(call.m_argc);
+      for (uint32_t i = 0; i < call.m_argc; ++i)
+      {
+        args[i] = this->eval(call.m_args[i], frame);
+      }
+
+      return done(this->apply(fn, args.data(), args.size()));
+    }
+    case Op::ForeignCall:
+    {
+      const ForeignCall &call = node->as.m_foreign;
+
+      // NOTE: The resolver checked that the args fit, see check_foreign_args
+      ssize_t args[TL::MAX_FOREIGN_ARGS];
+      size_t  argc = 0;
+      for (uint32_t i = 0; i < call.m_argc; ++i)
+      {
+        Value   arg  = this->eval(call.m_args[i], frame);
+        ssize_t word = 0;
+        switch (arg.m_kind)
+        {
+        case Kind::Int: word = arg.as.m_int; break;
+        case Kind::Str: word = (ssize_t)arg.as.m_string.m_mem; break;
+        case Kind::Fn : UT_TODO("Functions can not be passed to C yet"); break;
+        }
+        args[argc++] = word;
+      }
+
+      return done(Value{ TL::call_foreign(call.m_fn, args, argc) });
+    }
+    case Op::Add:
+    {
+      const BinOp &bin = node->as.m_bin;
+      return done(Value{ this->eval_int(bin.m_left, frame)
+                         + this->eval_int(bin.m_right, frame) });
+    }
+    case Op::Sub:
+    {
+      const BinOp &bin = node->as.m_bin;
+      return done(Value{ this->eval_int(bin.m_left, frame)
+                         - this->eval_int(bin.m_right, frame) });
+    }
+    case Op::Mult:
+    {
+      const BinOp &bin = node->as.m_bin;
+      return done(Value{ this->eval_int(bin.m_left, frame)
+                         * this->eval_int(bin.m_right, frame) });
+    }
+    case Op::Div:
+    {
+      const BinOp &bin = node->as.m_bin;
+      return done(Value{ this->eval_int(bin.m_left, frame)
+                         / this->eval_int(bin.m_right, frame) });
+    }
+    case Op::Modulus:
+    {
+      const BinOp &bin = node->as.m_bin;
+      return done(Value{ this->eval_int(bin.m_left, frame)
+                         % this->eval_int(bin.m_right, frame) });
+    }
+    case Op::IsEq:
+    {
+      const BinOp &bin = node->as.m_bin;
+      return done(Value{ (ssize_t)(this->eval_int(bin.m_left, frame)
+                                   == this->eval_int(bin.m_right, frame)) });
+    }
+    case Op::Minus:
+    {
+      return done(Value{ -this->eval_int(node->as.m_operand, frame) });
+    }
+    case Op::Not:
+    {
+      return done(
+        Value{ (ssize_t)!this->eval_int(node->as.m_operand, frame) });
+    }
+    case Op::If:
+    {
+      const If &if_else = node->as.m_if;
+      node = this->eval_int(if_else.m_condition, frame) ? if_else.m_true_branch
+                                                        : if_else.m_else_branch;
+      continue;
+    }
+    case Op::Let:
+    {
+      const Let &let = node->as.m_let;
+      Value      value = this->eval(let.m_value, frame);
+      *this->lookup(let.m_target, frame) = value;
+      node = let.m_continuation;
+      continue;
+    }
+    case Op::While:
+    {
+      const While &whyle = node->as.m_while;
+      for (uint32_t i = 0; i < whyle.m_carried_len; ++i)
+      {
+        frame->m_slots[whyle.m_carried_to[i]]
+          = *this->lookup(whyle.m_carried_from[i], frame);
+      }
+
+      for (;;)
+      {
+        TL::next_frame();
+        if (!this->eval_int(whyle.m_condition, frame)) break;
+        (void)this->eval(whyle.m_body, frame);
+      }
+      return done(Value{ (ssize_t)0 });
+    }
+    }
+  }
+
+  UT_FAIL_MSG("Op not resolved, op = %s", UT_TCS(node->m_op));
+  return Value{};
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (RS)
+ *------------------------------------------------------------------------------*/
+
+EX::Expr
+to_expr(
+  Value value)
+{
+  switch (value.m_kind)
+  {
+  case Kind::Int:
+  {
+    EX::Expr expr{ EX::Type::Int };
+    expr.as.m_int = value.as.m_int;
+    return expr;
+  }
+  case Kind::Str:
+  {
+    EX::Expr expr{ EX::Type::Str };
+    expr.as.m_string = value.as.m_string;
+    return expr;
+  }
+  case Kind::Fn:
+  {
+    EX::Expr expr{ EX::Type::FnDef };
+    expr.as.m_fn = value.as.m_fn.m_proto->m_source;
+    return expr;
+  }
+  }
+
+  UT_FAIL_IF("UNREACHABLE");
+  return EX::Expr{ EX::Type::Unknown };
+}
+
+Value
+eval(
+  const EX::Expr &expr, AR::Arena &arena)
+{
+  Globals  globals{};
+  Resolver resolver{ arena, globals };
+  Runtime  runtime{ arena, globals };
+
+  Proto *proto = resolver.resolve_def(expr, "");
+  return runtime.run(*proto);
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace RS
@@ -9,226 +9,1415 @@
 
 #include "TL.hpp"
 #include "EX.hpp"
+#include "FF.hpp"
+#include "JT.hpp"
 #include "LX.hpp"
+#include "OP.hpp"
+#include "PL.hpp"
+#include "RS.hpp"
 #include "UT.hpp"
+#include "VM.hpp"
 #include "ffi.h"
-#include <dlfcn.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace TL
 {
 
-using FnMap_t = std::map<std::string, void *>;
+// NOTE: A result of a pure or frame_stable ext def and the args it was for
+struct Cached
+{
+  bool    m_valid;
+  size_t  m_frame; // NOTE: the frame it was made in
+  ssize_t m_args[MAX_FOREIGN_ARGS];
+  ssize_t m_result;
+};
+
+// NOTE: Slots of every cached ext def, a call can only hit the slot its args
+// hash to
+constexpr size_t CACHE_LEN = 16;
+
+static std::atomic<size_t> next_id{ 1 };
+
+// NOTE: An ext def, its call interface is prepared and its symbol resolved once
+// when the module loads it, so calls only have to point at their args. Common
+// signatures get a thunk that calls the fn directly, libffi does the rest.
 class DFN
 {
 public:
-  const char    *m_fn_name;
-  ffi_type     **m_in_types;
-  ffi_type      *m_out_type;
-  static void   *m_handle;
-  static FnMap_t m_fn_map;
+  const char   *m_fn_name; // NOTE: interned, so NUL terminated
+  UT::Sym       m_fn_sym;
+  ffi_type    **m_in_types;
+  ffi_type     *m_out_type;
+  size_t        m_arity; // NOTE: C_void params are not counted
+  FF::Thunk     m_thunk; // NOTE: nullptr when the call goes through m_cif
+  bool          m_batch; // NOTE: calls are queued, see call_foreign
+  ffi_cif       m_cif;
+  void         *m_fn;
+  FF::Library  *m_library;
+  FF::Layout  **m_layouts; // NOTE: of every param, nullptr if none is a struct
+  FF::Layout   *m_result;  // NOTE: nullptr unless it returns a struct
+  Cached       *m_cache;   // NOTE: nullptr unless it is pure or frame_stable
+  bool          m_frame_stable;
+  bool          m_async; // NOTE: calls run on async_jobs, see call_async
+  size_t        m_id;    // NOTE: unique, the address is reused by later modules
 
   DFN(
-    const char *fn_name, ffi_type **in_types, ffi_type *out_type)
-      : m_fn_name{ fn_name },
+    UT::String   fn_name,
+    ffi_type   **in_types,
+    ffi_type    *out_type,
+    size_t       arity,
+    FF::Thunk    thunk,
+    FF::Library *library)
+      : m_fn_name{ UT::intern(fn_name).m_mem },
+        m_fn_sym{ UT::symbol(fn_name) },
         m_in_types{ in_types },
-        m_out_type{ out_type }
+        m_out_type{ out_type },
+        m_arity{ arity },
+        m_thunk{ thunk },
+        m_batch{ false },
+        m_cif{},
+        m_fn{ nullptr },
+        m_library{ library },
+        m_layouts{ nullptr },
+        m_result{ nullptr },
+        m_cache{ nullptr },
+        m_frame_stable{ false },
+        m_async{ false },
+        m_id{ next_id.fetch_add(1, std::memory_order_relaxed) }
   {
   }
 
-  static void
-  init(
-    UT::String lib_path)
+  void
+  prepare(
+    void)
   {
-    if (!m_handle) m_handle = dlopen(lib_path.m_mem, RTLD_LAZY | RTLD_LOCAL);
+    if (m_arity > MAX_FOREIGN_ARGS)
+    {
+      UT_FAIL_MSG("ERROR: function (%s) takes more than %zu args\n",
+                  m_fn_name,
+                  MAX_FOREIGN_ARGS);
+    }
+
+    m_fn = FF::Libraries::find(m_library, UT::Symbols::name(m_fn_sym));
+    if (!m_fn) UT_FAIL_MSG("ERROR: function (%s) not found\n", m_fn_name);
+    if (m_thunk) return;
+
+    if (ffi_prep_cif(&m_cif,
+                     FFI_DEFAULT_ABI,
+                     m_arity,
+                     m_out_type,
+                     m_arity ? m_in_types : nullptr)
+        != FFI_OK)
+    {
+      UT_FAIL_MSG("ERROR: function (%s) has no call interface\n", m_fn_name);
+    }
   }
 
+  // NOTE: args points at m_arity values
   void
-  configure(
-    void)
+  call(
+    void **args, void *output)
+  {
+    ffi_call(&m_cif, FFI_FN(m_fn), output, args);
+  };
+};
+
+using DFN_map = std::map<UT::Sym, DFN *>;
+
+static DFN_map foreign_functions = {};
+
+// NOTE: Layouts of the ext structs, by the name of the struct
+static std::map<UT::Sym, FF::Layout *> struct_layouts = {};
+
+// NOTE: Where the reference engine looks for fns that are neither defs nor
+// ext defs, opened on the first such call and closed with the module
+static FF::Library *fallback_library = nullptr;
+
+// NOTE: Native code of the reference defs, keyed by the body of the FnDef
+using Native_map = std::map<const EX::Expr *, const RS::Proto *>;
+
+static Native_map native_functions = {};
+
+// NOTE: Bodies of the reference defs found to be pure, and their results
+static std::set<const EX::Expr *> pure_functions = {};
+static MM::Memo                  *memo_table     = nullptr;
+static std::mutex                 memo_mutex{};
+
+// NOTE: Subexpressions the reference engine may run on the fork pool, found
+// by plan_forks, and how deep the forks may nest
+static PL::Pool                             *fork_pool   = nullptr;
+static size_t                                fork_limit  = 0;
+static std::unordered_set<const EX::Expr *> fork_points = {};
+static thread_local size_t                   fork_depth  = 0;
+
+// NOTE: Calls of batch ext defs that were not made yet. Every thread queues its
+// own, they are made in order before the next call of an ext def that is not
+// batched, once the queue is full and once the def that queued them is done.
+struct Command
+{
+  DFN    *m_fn;
+  size_t  m_argc;
+  ssize_t m_args[MAX_FOREIGN_ARGS];
+};
+
+constexpr size_t BATCH_LEN = 256;
+
+static thread_local Command batch[BATCH_LEN];
+static thread_local size_t  batch_len = 0;
+
+// NOTE: A struct that an ext def returns is unpacked into one of its result
+// slots on the calling thread, they are taken in turn. So the struct stays the
+// same until the def is called RESULT_SLOTS more times on that thread.
+constexpr size_t RESULT_SLOTS = 8;
+
+struct Results
+{
+  int   *m_ints; // NOTE: RESULT_SLOTS structs, one after the other
+  size_t m_next;
+};
+
+static int *
+result_slot(
+  DFN *foreign_fn)
+{
+  static thread_local std::unordered_map<size_t, Results> slots{};
+
+  size_t   len     = foreign_fn->m_result->m_len;
+  Results &results = slots[foreign_fn->m_id];
+  if (!results.m_ints) results.m_ints = thrax_ints((int)(len * RESULT_SLOTS));
+
+  int *ints      = results.m_ints + results.m_next * len;
+  results.m_next = (results.m_next + 1) % RESULT_SLOTS;
+  return ints;
+}
+
+static ssize_t
+call_now(
+  DFN *foreign_fn, const ssize_t *args, size_t argc)
+{
+  if (foreign_fn->m_thunk)
   {
-    if (m_fn_map.end() == m_fn_map.find(std::string(m_fn_name)))
+    if (argc >= foreign_fn->m_arity)
     {
-      void *fn_handle = dlsym(m_handle, m_fn_name);
-      if (!fn_handle)
-      {
-        UT_FAIL_MSG("ERROR: function (%s) not found\n", m_fn_name);
-      }
-      else
-      {
-        m_fn_map[std::string(m_fn_name)] = fn_handle;
-      }
+      return foreign_fn->m_thunk(foreign_fn->m_fn, args);
     }
-    else
+
+    ssize_t padded[MAX_FOREIGN_ARGS] = {};
+    for (size_t i = 0; i < argc; ++i) padded[i] = args[i];
+    return foreign_fn->m_thunk(foreign_fn->m_fn, padded);
+  }
+
+  ssize_t zero = 0;
+  void   *input[MAX_FOREIGN_ARGS];
+  for (size_t i = 0; i < foreign_fn->m_arity; ++i)
+  {
+    input[i] = (void *)(i < argc ? &args[i] : &zero);
+  }
+
+  // NOTE: Struct args are copied to their C layout on the stack
+  alignas(16) unsigned char structs[MAX_FOREIGN_ARGS][FF::MAX_STRUCT_SIZE];
+  if (foreign_fn->m_layouts)
+  {
+    for (size_t i = 0; i < foreign_fn->m_arity; ++i)
     {
-      // Nothing to do
+      FF::Layout *layout = foreign_fn->m_layouts[i];
+      if (!layout) continue;
+
+      FF::pack(*layout, (const int *)(i < argc ? args[i] : 0), structs[i]);
+      input[i] = structs[i];
     }
   }
 
-  static void
-  deinit(
-    void)
+  // NOTE: Large enough for any struct result
+  // The output might never be written to so 0 init
+  alignas(16) ssize_t output[FF::MAX_STRUCT_SIZE / sizeof(ssize_t)] = {};
+  foreign_fn->call(input, output);
+
+  if (foreign_fn->m_result)
   {
-    if (m_handle) dlclose(m_handle);
+    int *ints = result_slot(foreign_fn);
+    FF::unpack(*foreign_fn->m_result, output, ints);
+    return (ssize_t)ints;
   }
 
-  bool
-  call(
-    std::vector<void *> &input, void *output)
+  return output[0];
+}
+
+static void
+flush_foreign()
+{
+  for (size_t i = 0; i < batch_len; ++i)
   {
-    ffi_cif cif;
+    call_now(batch[i].m_fn, batch[i].m_args, batch[i].m_argc);
+  }
+  batch_len = 0;
+}
 
-    void **args = input.empty() ? nullptr : input.data();
+// NOTE: Frames are numbered across threads, so a frame_stable result is only
+// reused by the thread whose frame it was made in
+static std::atomic<size_t> frames{ 1 };
+static thread_local size_t current_frame = 0;
 
-    if (ffi_prep_cif(&cif,
-                     FFI_DEFAULT_ABI,
-                     input.size(),
-                     m_out_type,
-                     input.empty() ? nullptr : m_in_types)
-        != FFI_OK)
-      return false;
+static std::mutex cache_mutex{};
+static MM::Stats  cache_stats{};
 
-    void *fn_handle = m_fn_map[std::string(m_fn_name)];
+void
+next_frame()
+{
+  current_frame = frames.fetch_add(1, std::memory_order_relaxed);
+}
 
-    ffi_call(&cif, FFI_FN(fn_handle), output, args);
+static ssize_t
+call_cached(
+  DFN *foreign_fn, const ssize_t *args, size_t argc)
+{
+  ssize_t key[MAX_FOREIGN_ARGS] = {};
+  size_t  hash                  = foreign_fn->m_fn_sym;
+  for (size_t i = 0; i < foreign_fn->m_arity; ++i)
+  {
+    if (i < argc) key[i] = args[i];
+    hash = hash * 31 + (size_t)key[i];
+  }
 
-    return true;
-  };
-};
+  Cached &cached = foreign_fn->m_cache[hash % CACHE_LEN];
+  bool    same   = false;
+  {
+    std::lock_guard<std::mutex> lock{ cache_mutex };
+    same = cached.m_valid
+           && !std::memcmp(
+             cached.m_args, key, foreign_fn->m_arity * sizeof(ssize_t));
+    if (same
+        && (!foreign_fn->m_frame_stable || current_frame == cached.m_frame))
+    {
+      cache_stats.m_hits += 1;
+      return cached.m_result;
+    }
+    cache_stats.m_misses += 1;
+  }
 
-void   *DFN::m_handle = nullptr;
-FnMap_t DFN::m_fn_map = {};
+  flush_foreign();
+  ssize_t result = call_now(foreign_fn, key, foreign_fn->m_arity);
 
-using DFN_map = std::map<std::string, DFN *>;
+  std::lock_guard<std::mutex> lock{ cache_mutex };
+  if (cached.m_valid && !same) cache_stats.m_evictions += 1;
+  cached.m_valid  = true;
+  cached.m_frame  = current_frame;
+  cached.m_result = result;
+  std::memcpy(cached.m_args, key, sizeof(key));
+  return result;
+}
 
-static DFN_map foreign_functions = {};
+// NOTE: The native threads that async ext defs run on, for the module that is
+// being loaded
+static PL::Jobs *async_jobs = nullptr;
+
+// NOTE: The handle of a call is its ticket + 1, so that 0 is never a handle
+static ssize_t
+call_async(
+  DFN *foreign_fn, const ssize_t *args, size_t argc)
+{
+  flush_foreign();
+
+  std::array<ssize_t, MAX_FOREIGN_ARGS> words{};
+  for (size_t i = 0; i < argc && i < MAX_FOREIGN_ARGS; ++i) words[i] = args[i];
+
+  size_t arity = foreign_fn->m_arity;
+  return 1 + async_jobs->post([foreign_fn, words, arity] {
+    return call_now(foreign_fn, words.data(), arity);
+  });
+}
+
+extern "C" ssize_t
+thrax_await(
+  int handle)
+{
+  if (!async_jobs || handle <= 0)
+  {
+    UT_FAIL_MSG("ERROR: (%d) is not the handle of an async call\n", handle);
+  }
+  return async_jobs->wait(handle - 1);
+}
+
+DFN *
+find_foreign(
+  UT::String name)
+{
+  auto it = foreign_functions.find(UT::symbol(name));
+  return foreign_functions.end() == it ? nullptr : it->second;
+}
+
+void
+check_foreign_args(
+  DFN *foreign_fn, size_t argc)
+{
+  if (argc <= MAX_FOREIGN_ARGS) return;
+
+  UT_FAIL_MSG("ERROR: function (%s) is called with %zu args, C calls take at "
+              "most %zu\n",
+              foreign_fn->m_fn_name,
+              argc,
+              MAX_FOREIGN_ARGS);
+}
+
+ssize_t
+call_foreign(
+  DFN *foreign_fn, const ssize_t *args, size_t argc)
+{
+  if (foreign_fn->m_cache) return call_cached(foreign_fn, args, argc);
+  if (foreign_fn->m_async) return call_async(foreign_fn, args, argc);
+  if (!foreign_fn->m_batch)
+  {
+    flush_foreign();
+    return call_now(foreign_fn, args, argc);
+  }
+
+  if (BATCH_LEN == batch_len) flush_foreign();
+
+  Command &command = batch[batch_len++];
+  command.m_fn     = foreign_fn;
+  command.m_argc   = std::min(argc, MAX_FOREIGN_ARGS);
+  for (size_t i = 0; i < command.m_argc; ++i) command.m_args[i] = args[i];
+
+  // NOTE: Batch defs return C_void, which is always 0
+  return 0;
+}
+
+// NOTE: The buffers handed out to ext calls belong to the arena of the module
+// that is being loaded, so they live as long as its values do
+static AR::Arena *buffer_arena = nullptr;
+static std::mutex buffer_mutex{};
+
+extern "C" void *
+thrax_buffer(
+  int len)
+{
+  std::lock_guard<std::mutex> lock{ buffer_mutex };
+  if (!buffer_arena) UT_FAIL_MSG("ERROR: no module to own a buffer of %d", len);
+
+  size_t size   = len > 0 ? len : 0;
+  void  *buffer = buffer_arena->alloc(size ? size : 1);
+  std::memset(buffer, 0, size);
+  return buffer;
+}
+
+extern "C" int *
+thrax_ints(
+  int len)
+{
+  return (int *)thrax_buffer(len > 0 ? len * (int)sizeof(int) : 0);
+}
+
+extern "C" int
+thrax_get(
+  const int *ints, int idx)
+{
+  return ints[idx];
+}
+
+extern "C" void
+thrax_set(
+  int *ints, int idx, int value)
+{
+  ints[idx] = value;
+}
 
-std::vector<LX::LangType>
+std::vector<LX::Sig>
 expand_signature(
   LX::Sig &sig)
 {
-  std::vector<LX::LangType> expansion{};
+  std::vector<LX::Sig> expansion{};
 
   if (LX::LangType::Fn == sig.type)
   {
-    expansion.push_back(sig.as.pair.first().type);
-    LX::Sig                   left_sig       = sig.as.pair.second();
-    std::vector<LX::LangType> left_expansion = expand_signature(left_sig);
+    expansion.push_back(sig.as.pair.first());
+    LX::Sig              left_sig       = sig.as.pair.second();
+    std::vector<LX::Sig> left_expansion = expand_signature(left_sig);
     expansion.insert(
       expansion.end(), left_expansion.begin(), left_expansion.end());
   }
   else
   {
-    expansion.push_back(sig.type);
+    expansion.push_back(sig);
   }
 
   return expansion;
 }
 
+// NOTE: The layout of a Struct param or result, nullptr for the other types
+static FF::Layout *
+struct_layout(
+  const LX::Sig &sig, UT::String ext_name)
+{
+  if (LX::LangType::Nat8 == sig.type || LX::LangType::Float == sig.type)
+  {
+    UT_FAIL_MSG("ERROR: function (%s) takes %s, which only struct fields can\n",
+                UT_TCS(ext_name),
+                UT_TCS(sig.type));
+  }
+  if (LX::LangType::Struct != sig.type) return nullptr;
+
+  auto it = struct_layouts.find(sig.as.name);
+  if (struct_layouts.end() == it)
+  {
+    UT_FAIL_MSG("ERROR: function (%s) takes an unknown struct (%s)\n",
+                UT_TCS(ext_name),
+                UT_TCS(UT::Symbols::name(sig.as.name)));
+  }
+  return it->second;
+}
+
+// NOTE: A def of the Frames or VM engines, resolved and waiting to be run
+struct Pending
+{
+  size_t               m_def; // NOTE: index in Mod::m_defs
+  UT::String           m_name;
+  RS::Proto           *m_proto;
+  bool                 m_memoize;
+  std::vector<UT::Sym> m_names;
+};
+
+// NOTE: What a thread needs to run defs, its frames come from its own arena
+struct Worker
+{
+  AR::Arena   m_arena;
+  RS::Runtime m_runtime;
+  VM::Machine m_machine;
+  MM::Memo    m_memo;
+
+  Worker(
+    RS::Globals &globals, Options options)
+      : m_arena{},
+        m_runtime{ m_arena, globals },
+        m_machine{ m_arena, globals, options.m_max_frames },
+        m_memo{ options.m_memo_limit }
+  {
+    if (options.m_memo_limit)
+    {
+      this->m_runtime.m_memo            = &this->m_memo;
+      this->m_machine.m_fallback.m_memo = &this->m_memo;
+    }
+  }
+};
+
+// NOTE: Every name that appears in expr, locals included. The names are only
+// used to order defs, so a local named like a def only costs some parallelism
+static void
+collect_names(
+  const EX::Expr &expr, std::vector<UT::Sym> &names)
+{
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str:
+  case EX::Type::Unknown: break;
+  case EX::Type::Var    : names.push_back(UT::symbol(expr.as.m_var)); break;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    collect_names(pair.first(), names);
+    collect_names(pair.second(), names);
+  }
+  break;
+  case EX::Type::Minus:
+  case EX::Type::Not  : collect_names(*expr.as.m_expr, names); break;
+  case EX::Type::If:
+  {
+    collect_names(*expr.as.m_if.m_condition, names);
+    collect_names(*expr.as.m_if.m_true_branch, names);
+    collect_names(*expr.as.m_if.m_else_branch, names);
+  }
+  break;
+  case EX::Type::Let:
+  {
+    collect_names(*expr.as.m_let.m_value, names);
+    collect_names(*expr.as.m_let.m_continuation, names);
+  }
+  break;
+  case EX::Type::While:
+  {
+    collect_names(*expr.as.m_while.m_condition, names);
+    collect_names(*expr.as.m_while.m_body, names);
+  }
+  break;
+  case EX::Type::FnDef: collect_names(*expr.as.m_fn.m_body, names); break;
+  case EX::Type::FnApp:
+  {
+    for (const EX::Expr &param : expr.as.m_fnapp.m_param)
+    {
+      collect_names(param, names);
+    }
+    collect_names(*expr.as.m_fnapp.m_body.m_body, names);
+  }
+  break;
+  case EX::Type::VarApp:
+  {
+    names.push_back(UT::symbol(expr.as.m_varapp.m_fn_name));
+    for (const EX::Expr &param : expr.as.m_varapp.m_param)
+    {
+      collect_names(param, names);
+    }
+  }
+  break;
+  }
+}
+
+// NOTE: A def waits for
+// - the defs it reads, and the defs those read, since a call looks the globals
+//   up when it is made and not when its fn was defined
+// - the defs before it that read or bind the name it binds
+// - the def before it that calls into C, so that C sees its calls in order
+static PL::Graph
+order_defs(
+  const std::vector<Pending> &pending)
+{
+  PL::Graph                              graph{};
+  std::map<UT::Sym, size_t>              latest{};
+  std::map<UT::Sym, std::vector<size_t>> readers{};
+  size_t                                 last_foreign = SIZE_MAX;
+
+  for (size_t i = 0; i < pending.size(); ++i)
+  {
+    graph.add();
+
+    std::set<size_t>     deps{};
+    std::set<UT::Sym>    read{};
+    std::vector<UT::Sym> names = pending[i].m_names;
+    bool                 foreign = false;
+
+    while (!names.empty())
+    {
+      UT::Sym sym = names.back();
+      names.pop_back();
+      if (!read.insert(sym).second) continue;
+
+      if (find_foreign(UT::Symbols::name(sym))) foreign = true;
+
+      auto def = latest.find(sym);
+      if (latest.end() == def) continue;
+
+      deps.insert(def->second);
+      const std::vector<UT::Sym> &more = pending[def->second].m_names;
+      names.insert(names.end(), more.begin(), more.end());
+    }
+
+    UT::Sym name     = UT::symbol(pending[i].m_name);
+    auto    previous = latest.find(name);
+    if (latest.end() != previous) deps.insert(previous->second);
+
+    auto name_readers = readers.find(name);
+    if (readers.end() != name_readers)
+    {
+      deps.insert(name_readers->second.begin(), name_readers->second.end());
+    }
+
+    if (foreign)
+    {
+      if (SIZE_MAX != last_foreign) deps.insert(last_foreign);
+      last_foreign = i;
+    }
+
+    for (size_t dep : deps) graph.depend(i, dep);
+
+    latest[name] = i;
+    for (UT::Sym sym : read) readers[sym].push_back(i);
+  }
+
+  return graph;
+}
+
+// NOTE: Whether evaluating expr can call a fn, anything else is too little
+// work to be worth handing to another thread
+static bool
+has_call(
+  const EX::Expr &expr)
+{
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str:
+  case EX::Type::Var:
+  case EX::Type::Unknown: return false;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    return has_call(pair.first()) || has_call(pair.second());
+  }
+  case EX::Type::Minus:
+  case EX::Type::Not  : return has_call(*expr.as.m_expr);
+  case EX::Type::If:
+  {
+    return has_call(*expr.as.m_if.m_condition)
+           || has_call(*expr.as.m_if.m_true_branch)
+           || has_call(*expr.as.m_if.m_else_branch);
+  }
+  case EX::Type::Let:
+  {
+    return has_call(*expr.as.m_let.m_value)
+           || has_call(*expr.as.m_let.m_continuation);
+  }
+  case EX::Type::While:
+  {
+    return has_call(*expr.as.m_while.m_condition)
+           || has_call(*expr.as.m_while.m_body);
+  }
+  case EX::Type::FnDef : return has_call(*expr.as.m_fn.m_body);
+  case EX::Type::FnApp :
+  case EX::Type::VarApp: return true;
+  }
+
+  UT_FAIL_IF("UNREACHABLE");
+  return false;
+}
+
+// NOTE: Records in fork_points the subexpressions of a pure def whose halves
+// both call a fn:
+// - the operands of a bin op, keyed by the first operand
+// - the values of a let and the let right after it, keyed by the first value,
+//   when the second value does not read the first name. The check is on names,
+//   a local of the same name in the second value only costs the fork.
+static void
+plan_forks(
+  const EX::Expr &expr)
+{
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str:
+  case EX::Type::Var:
+  case EX::Type::Unknown: break;
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    plan_forks(pair.first());
+    plan_forks(pair.second());
+
+    if (has_call(pair.first()) && has_call(pair.second()))
+    {
+      fork_points.insert(pair.begin());
+    }
+  }
+  break;
+  case EX::Type::Minus:
+  case EX::Type::Not  : plan_forks(*expr.as.m_expr); break;
+  case EX::Type::If:
+  {
+    plan_forks(*expr.as.m_if.m_condition);
+    plan_forks(*expr.as.m_if.m_true_branch);
+    plan_forks(*expr.as.m_if.m_else_branch);
+  }
+  break;
+  case EX::Type::Let:
+  {
+    const EX::Let &let = expr.as.m_let;
+    plan_forks(*let.m_value);
+    plan_forks(*let.m_continuation);
+
+    if (EX::Type::Let != let.m_continuation->m_type) break;
+
+    const EX::Let &next = let.m_continuation->as.m_let;
+    if (!has_call(*let.m_value) || !has_call(*next.m_value)) break;
+
+    std::vector<UT::Sym> names{};
+    collect_names(*next.m_value, names);
+    for (UT::Sym name : names)
+    {
+      if (UT::symbol(let.m_var_name) == name) return;
+    }
+    fork_points.insert(let.m_value);
+  }
+  break;
+  case EX::Type::While:
+  {
+    plan_forks(*expr.as.m_while.m_condition);
+    plan_forks(*expr.as.m_while.m_body);
+  }
+  break;
+  case EX::Type::FnDef: plan_forks(*expr.as.m_fn.m_body); break;
+  case EX::Type::FnApp:
+  {
+    for (const EX::Expr &param : expr.as.m_fnapp.m_param) plan_forks(param);
+    plan_forks(*expr.as.m_fnapp.m_body.m_body);
+  }
+  break;
+  case EX::Type::VarApp:
+  {
+    for (const EX::Expr &param : expr.as.m_varapp.m_param) plan_forks(param);
+  }
+  break;
+  }
+}
+
+// NOTE: The top level defs of a module in the order of the source, with the
+// parsed expr of every int and pub def and nullptr for ext defs
+struct Read
+{
+  std::vector<LX::Token>  m_tokens;
+  std::vector<EX::Expr *> m_exprs;
+};
+
+// NOTE: Every top level def is lexed and parsed on its own, so the defs are
+// split between the workers at the keywords that begin them. Worker 0 is this
+// thread and uses arena, the others use arenas, which the module keeps.
+static Read
+read_defs(
+  UT::String                               source,
+  AR::Arena                               &arena,
+  size_t                                   workers,
+  std::vector<std::unique_ptr<AR::Arena>> &arenas)
+{
+  LX::Lexer index{ source.m_mem, arena, 0, source.m_len };
+  index.index_defs();
+  const std::vector<size_t> &offsets = index.m_def_offsets;
+
+  // NOTE: Text before the first def is read with it
+  size_t len = std::max<size_t>(offsets.size(), 1);
+
+  std::vector<std::unique_ptr<LX::Lexer>> lexers(len);
+  std::vector<std::vector<EX::Expr *>>    exprs(len);
+
+  PL::Graph graph{};
+  for (size_t i = 0; i < len; ++i) graph.add();
+
+  workers = std::min(workers, len);
+  while (arenas.size() + 1 < workers)
+  {
+    arenas.push_back(std::make_unique<AR::Arena>());
+  }
+
+  graph.run(workers, [&](size_t task, size_t worker) {
+    AR::Arena &own   = worker ? *arenas[worker - 1] : arena;
+    size_t     begin = task ? offsets[task] : 0;
+    size_t     end   = source.m_len;
+    if (task + 1 < offsets.size()) end = offsets[task + 1];
+
+    // NOTE: The part holds a single def, so it is not indexed again
+    lexers[task] = std::make_unique<LX::Lexer>(source.m_mem, own, begin, end);
+    LX::Lexer &l = *lexers[task];
+    if (task < offsets.size()) l.m_def_offsets = { offsets[task] };
+    l.m_indexed = true;
+    l.run();
+
+    for (LX::Token t : l.m_tokens)
+    {
+      if (LX::Type::IntDef != t.type && LX::Type::PubDef != t.type)
+      {
+        exprs[task].push_back(nullptr);
+        continue;
+      }
+
+      EX::Parser parser{ t.as.sym.def, own, source.m_mem };
+      parser.run();
+      exprs[task].push_back(parser.m_exprs.last());
+    }
+  });
+
+  Read read{};
+  for (size_t i = 0; i < len; ++i)
+  {
+    lexers[i]->generate_event_report();
+    for (LX::Token t : lexers[i]->m_tokens) read.m_tokens.push_back(t);
+    read.m_exprs.insert(read.m_exprs.end(), exprs[i].begin(), exprs[i].end());
+  }
+  return read;
+}
+
 Mod::Mod(
-  UT::String file_name, AR::Arena &arena)
+  UT::String file_name, AR::Arena &arena, Options options)
 {
   UT::String source_code = UT::read_entire_file(file_name, arena);
   this->m_defs           = { arena };
   this->m_name           = file_name;
 
-  LX::Lexer l{ source_code.m_mem, arena, 0, source_code.m_len };
-  l.run();
-  l.generate_event_report();
+  Read read = read_defs(
+    source_code, arena, PL::workers(options.m_workers), this->m_arenas);
+
+  Env          global_env{};
+  RS::Globals  globals{};
+  RS::Resolver resolver{ arena, globals };
+  RS::Runtime  runtime{ arena, globals };
+  VM::Machine  machine{ arena, globals, options.m_max_frames };
+  JT::Jit      jit{};
+  MM::Purity   purity{};
+  OP::Folder   folder{};
+  MM::Memo     memo{ options.m_memo_limit };
+
+  if (options.m_memo_limit)
+  {
+    runtime.m_memo = &memo;
+    memo_table     = &memo;
+  }
+  buffer_arena = &arena;
+  cache_stats  = {};
+
+  // NOTE: Only the Reference engine forks inside of a def
+  std::unique_ptr<PL::Pool> pool{};
+  if (Engine::Reference == options.m_engine && options.m_fork_depth)
+  {
+    pool       = std::make_unique<PL::Pool>(PL::workers(options.m_workers));
+    fork_pool  = pool.get();
+    fork_limit = options.m_fork_depth;
+  }
+
+  for (LX::Token t : read.m_tokens)
+  {
+    if (LX::Type::ExtDef == t.type || LX::Type::StructDef == t.type) continue;
+    folder.declare(t.as.sym.name);
+  }
+
+  std::vector<Pending>       pending{};
+  std::vector<FF::Library *> libraries{}; // NOTE: held open by the ext defs
+  std::unique_ptr<PL::Jobs>  jobs{};      // NOTE: made for the first async def
+
+  for (size_t def_idx = 0; def_idx < read.m_tokens.size(); ++def_idx)
+  {
+    LX::Token t        = read.m_tokens[def_idx];
+    TL::Type  def_type = TL::Type::ExtDef;
+    switch (t.type)
+    {
+    // TODO: this should be handled better
+    case LX::Type::PubDef   : def_type = TL::Type::PubDef; break;
+    case LX::Type::IntDef   : def_type = TL::Type::IntDef; break;
+    case LX::Type::ExtDef   : def_type = TL::Type::ExtDef; break;
+    case LX::Type::StructDef: def_type = TL::Type::ExtDef; break;
+    default: UT_FAIL_MSG("UNREACHABLE token type: %s", UT_TCS(t.type));
+    }
+
+    if (LX::Type::StructDef == t.type)
+    {
+      std::vector<LX::Sig>      fields = expand_signature(t.as.ext_sym.sig);
+      std::vector<LX::LangType> types{};
+      for (LX::Sig field : fields) types.push_back(field.type);
+
+      FF::Layout *layout = FF::layout(types.data(), types.size(), arena);
+      if (!layout)
+      {
+        UT_FAIL_MSG("ERROR: struct (%s) has to be at most %zu bytes of C_int, "
+                    "C_byte and C_float\n",
+                    UT_TCS(t.as.ext_sym.name),
+                    FF::MAX_STRUCT_SIZE);
+      }
+      struct_layouts[UT::symbol(t.as.ext_sym.name)] = layout;
+      continue;
+    }
+
+    // TODO: this should be handled better
+    if (LX::Type::ExtDef == t.type)
+    {
+      LX::Sig sig = t.as.ext_sym.sig;
+
+      if (LX::LangType::Fn == sig.type)
+      {
+        // TODO: It is assumed C functions are simple (Type, Type, Type) -> Type
+        // where Type is not a function type or a structure or union
+        // ie, it is a primitive, or effectively an alias to a primitive
+        auto       expansion = expand_signature(sig);
+        UT::String ext_name  = t.as.ext_sym.name;
+
+        size_t arity = 0;
+        auto   sig_in_types
+          = (ffi_type **)arena.alloc<ffi_type *>(expansion.size() - 1);
+        ffi_type *sig_out_types = nullptr;
+
+        LX::LangType params[FF::MAX_THUNK_ARGS];
+        auto         layouts
+          = (FF::Layout **)arena.alloc<FF::Layout *>(expansion.size() - 1);
+        bool has_structs = false;
+        bool by_address  = false; // NOTE: takes memory that may change
+
+        for (size_t i = 0; i < expansion.size() - 1; ++i)
+        {
+          LX::LangType t = expansion[i].type;
+
+          // NOTE: C_void params take no arg, so they are left out of the cif
+          if (LX::LangType::Void == t) continue;
+
+          layouts[arity] = struct_layout(expansion[i], ext_name);
+          if (layouts[arity])
+          {
+            sig_in_types[arity] = &layouts[arity]->m_type;
+            has_structs         = true;
+          }
+          else
+          {
+            sig_in_types[arity]
+              = FF::is_pointer(t) ? &ffi_type_pointer : &ffi_type_sint;
+          }
+          by_address |= has_structs
+                        || (FF::is_pointer(t) && LX::LangType::Ptr != t);
+          if (arity < FF::MAX_THUNK_ARGS) params[arity] = t;
+          arity += 1;
+        }
+
+        LX::LangType result        = expansion.back().type;
+        FF::Layout  *result_layout = struct_layout(expansion.back(), ext_name);
+        if (result_layout) sig_out_types = &result_layout->m_type;
+        else if (FF::is_pointer(result)) sig_out_types = &ffi_type_pointer;
+        else if (LX::LangType::Void == result) sig_out_types = &ffi_type_void;
+        else sig_out_types = &ffi_type_sint;
+
+        auto sym = (DFN *)arena.alloc(sizeof(DFN));
+        *sym     = { t.as.ext_sym.def[0].as.string,
+                     sig_in_types,
+                     sig_out_types,
+                     arity,
+                     FF::thunk(params, arity, result),
+                     FF::Libraries::open(t.as.ext_sym.def[1].as.string) };
+        sym->m_layouts = has_structs ? layouts : nullptr;
+        sym->m_result  = result_layout;
+        libraries.push_back(sym->m_library);
+        sym->prepare();
+
+        for (size_t i = 2; i < t.as.ext_sym.def.m_len; ++i)
+        {
+          LX::Token attribute = t.as.ext_sym.def[i];
+          if (LX::Type::Str == attribute.type && "batch" == attribute.as.string)
+          {
+            if (LX::LangType::Void != result)
+            {
+              UT_FAIL_MSG("ERROR: batch function (%s) has to return C_void\n",
+                          sym->m_fn_name);
+            }
+            // NOTE: Queued calls only keep the address of a struct, buffer or
+            // string, which may be written to before the call is made
+            if (by_address)
+            {
+              UT_FAIL_MSG("ERROR: batch function (%s) can only take values\n",
+                          sym->m_fn_name);
+            }
+            sym->m_batch = true;
+          }
+          else if (LX::Type::Str == attribute.type
+                   && ("pure" == attribute.as.string
+                       || "frame_stable" == attribute.as.string))
+          {
+            // NOTE: Calls are told apart by their args, which can not point
+            // at memory that C or Thrax may write to
+            if (by_address || result_layout)
+            {
+              UT_FAIL_MSG("ERROR: cached function (%s) has to take and return "
+                          "values\n",
+                          sym->m_fn_name);
+            }
+            if (!sym->m_cache)
+            {
+              sym->m_cache = (Cached *)arena.alloc<Cached>(CACHE_LEN);
+              std::memset(sym->m_cache, 0, CACHE_LEN * sizeof(Cached));
+            }
+            sym->m_frame_stable |= "frame_stable" == attribute.as.string;
+          }
+          else if (LX::Type::Str == attribute.type
+                   && "async" == attribute.as.string)
+          {
+            if (!jobs)
+            {
+              size_t workers = PL::workers(options.m_workers);
+              jobs           = std::make_unique<PL::Jobs>(workers);
+              async_jobs     = jobs.get();
+            }
+            sym->m_async = true;
+          }
+          else
+          {
+            UT_FAIL_MSG("ERROR: function (%s) has an unknown attribute (%s)\n",
+                        sym->m_fn_name,
+                        UT_TCS(attribute));
+          }
+        }
+
+        if (sym->m_batch && sym->m_cache)
+        {
+          UT_FAIL_MSG("ERROR: batch function (%s) can not be cached\n",
+                      sym->m_fn_name);
+        }
+        if (sym->m_async && (sym->m_batch || sym->m_cache))
+        {
+          UT_FAIL_MSG(
+            "ERROR: async function (%s) can not be batched or cached\n",
+            sym->m_fn_name);
+        }
+        // NOTE: The result slots of a worker would be reused before the
+        // handles of earlier calls are waited on
+        if (sym->m_async && sym->m_result)
+        {
+          UT_FAIL_MSG("ERROR: async function (%s) can not return a struct\n",
+                      sym->m_fn_name);
+        }
+
+        foreign_functions[UT::symbol(t.as.ext_sym.name)] = sym;
+      }
+
+      continue;
+    }
+
+    UT::String def_name = t.as.sym.name;
+
+    EX::Expr value{ EX::Type::Unknown };
+
+    EX::Expr &def_expr = *read.m_exprs[def_idx];
+    size_t    folded   = options.m_fold ? folder.run(def_name, def_expr) : 0;
+
+    bool pure = (options.m_memo_limit || fork_pool)
+                && EX::Type::FnDef == def_expr.m_type
+                && purity.analyse(def_name, def_expr);
+    bool memoize = options.m_memo_limit && pure
+                   && !MM::calls_self_in_tail(def_name, def_expr);
+
+    // NOTE: Forks only run code without side effects, so their order is moot
+    if (fork_pool && pure) plan_forks(def_expr);
+
+    switch (options.m_engine)
+    {
+    case Engine::Reference:
+    {
+      Instance instance{ def_expr, global_env };
+      next_frame();
+      instance = eval(instance);
+      value    = instance.m_expr;
+      flush_foreign();
+
+      auto previous = global_env.find(UT::symbol(def_name));
+      if (global_env.end() != previous
+          && EX::Type::FnDef == previous->second.m_type)
+      {
+        native_functions.erase(previous->second.as.m_fn.m_body);
+        pure_functions.erase(previous->second.as.m_fn.m_body);
+      }
+      global_env[UT::symbol(def_name)] = value;
+
+      if (memoize) pure_functions.insert(value.as.m_fn.m_body);
+
+      if (options.m_jit && !memoize && EX::Type::FnDef == value.m_type)
+      {
+        RS::Proto *def = resolver.resolve_def(value, def_name);
+        RS::Value  fn  = runtime.run(*def);
+        if (jit.compile(fn, globals.slot(def_name)))
+        {
+          native_functions[value.as.m_fn.m_body] = fn.as.m_fn.m_proto;
+        }
+      }
+    }
+    break;
+    case Engine::Frames:
+    case Engine::VM:
+    {
+      // NOTE: Resolved in order, so that names bind like they would if the
+      // defs were run one after another, then run once the module is read
+      RS::Proto *proto = resolver.resolve_def(def_expr, def_name);
+      globals.slot(def_name);
+      if (Engine::VM == options.m_engine) machine.prepare(*proto);
+
+      pending.push_back(
+        Pending{ this->m_defs.m_len, def_name, proto, memoize, {} });
+      collect_names(def_expr, pending.back().m_names);
+    }
+    break;
+    }
+
+    TL::Def def{ def_type, def_name, value, folded };
+
+    this->m_defs.push(def);
+
+    if (!true)
+    {
+      std::printf("%s %s = %s\n",
+                  UT_TCS(def.m_type),
+                  UT_TCS(def_name),
+                  UT_TCS(def.m_expr));
+    }
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers{};
+  size_t workers_len = std::min(PL::workers(options.m_workers), pending.size());
+  for (size_t i = 0; i < workers_len; ++i)
+  {
+    workers.push_back(std::make_unique<Worker>(globals, options));
+  }
+
+  std::mutex jit_mutex{};
+  PL::Graph  graph = order_defs(pending);
+  graph.run(workers_len, [&](size_t task, size_t worker_idx) {
+    const Pending &def    = pending[task];
+    Worker        &worker = *workers[worker_idx];
+
+    next_frame();
+    RS::Value result = Engine::VM == options.m_engine
+                         ? worker.m_machine.run(*def.m_proto)
+                         : worker.m_runtime.run(*def.m_proto);
+    flush_foreign();
+    globals.define(def.m_name, result);
+
+    if (def.m_memoize) result.as.m_fn.m_proto->m_memo = true;
+    else if (options.m_jit)
+    {
+      std::lock_guard<std::mutex> lock{ jit_mutex };
+      jit.compile(result, globals.slot(def.m_name));
+    }
+
+    this->m_defs[def.m_def].m_expr = RS::to_expr(result);
+  });
 
-  Env global_env{};
+  std::map<std::string, EX::Expr> defined{};
+  for (TL::Def &def : this->m_defs)
+  {
+    defined.insert_or_assign(std::to_string(def.m_name), def.m_expr);
+  }
 
-  for (LX::Token t : l.m_tokens)
+  for (auto it = defined.begin(); it != defined.end(); ++it)
   {
-    TL::Type def_type = TL::Type::ExtDef;
-    switch (t.type)
-    {
-    // TODO: this should be handled better
-    case LX::Type::PubDef: def_type = TL::Type::PubDef; break;
-    case LX::Type::IntDef: def_type = TL::Type::IntDef; break;
-    case LX::Type::ExtDef: def_type = TL::Type::ExtDef; break;
-    default              : UT_FAIL_MSG("UNREACHABLE token type: %s", UT_TCS(t.type));
-    }
+    std::printf("INFO: %s -> %s\n", it->first.c_str(), UT_TCS(it->second));
+  }
 
-    // TODO: this should be handled better
-    if (LX::Type::ExtDef == t.type)
+  for (TL::Def &def : this->m_defs)
+  {
+    if (!def.m_folded) continue;
+    std::printf(
+      "INFO: folded %zu nodes of %s\n", def.m_folded, UT_TCS(def.m_name));
+  }
+
+  if (options.m_memo_limit)
+  {
+    this->m_memo = memo.m_stats;
+    for (std::unique_ptr<Worker> &worker : workers)
     {
-      LX::Sig sig = t.as.ext_sym.sig;
-      DFN::init(t.as.ext_sym.def[1].as.string);
+      this->m_memo.m_hits += worker->m_memo.m_stats.m_hits;
+      this->m_memo.m_misses += worker->m_memo.m_stats.m_misses;
+      this->m_memo.m_evictions += worker->m_memo.m_stats.m_evictions;
+    }
+    std::printf("INFO: memo %s\n", UT_TCS(this->m_memo));
+  }
 
-      if (LX::LangType::Fn == sig.type)
-      {
-        // TODO: It is assumed C functions are simple (Type, Type, Type) -> Type
-        // where Type is not a function type or a structure or union
-        // ie, it is a primitive, or effectively an alias to a primitive
-        auto expansion = expand_signature(sig);
+  this->m_ext_cache = cache_stats;
+  if (cache_stats.m_hits || cache_stats.m_misses)
+  {
+    std::printf("INFO: ext cache %s\n", UT_TCS(this->m_ext_cache));
+  }
 
-        size_t idx = 0;
-        auto   sig_in_types
-          = (ffi_type **)arena.alloc<ffi_type *>(expansion.size() - 1);
-        ffi_type *sig_out_types = nullptr;
+  native_functions.clear();
+  pure_functions.clear();
+  foreign_functions.clear();
+  struct_layouts.clear();
+
+  // NOTE: Async calls nobody waited for still need their libraries
+  jobs.reset();
+  async_jobs = nullptr;
+
+  for (FF::Library *library : libraries) FF::Libraries::close(library);
+  if (fallback_library) FF::Libraries::close(fallback_library);
+  fallback_library = nullptr;
+  memo_table   = nullptr;
+  fork_pool    = nullptr;
+  buffer_arena = nullptr;
+  fork_points.clear();
+}
 
-        for (size_t i = 0; i < expansion.size() - 1; ++i)
-        {
-          LX::LangType t = expansion[i];
-          // TODO: Handle all other cases
-          switch (t)
-          {
-          case LX::LangType::Ptr : sig_in_types[idx] = &ffi_type_pointer; break;
-          case LX::LangType::Void: sig_in_types[idx] = &ffi_type_void; break;
-          default                : sig_in_types[idx] = &ffi_type_sint; break;
-          }
-          idx += 1;
-        }
+// NOTE: The word a C call gets for arg, for args that can be read without
+// eval, which copies its env
+static bool
+foreign_word(
+  const EX::Expr &arg, const Env &env, ssize_t &word)
+{
+  const EX::Expr *value = &arg;
+  if (EX::Type::Var == arg.m_type)
+  {
+    auto it = env.find(UT::symbol(arg.as.m_var));
+    if (env.end() == it) return false;
+    value = &it->second;
+  }
 
-        switch (expansion.back())
-        {
-        case LX::LangType::Ptr : sig_out_types = &ffi_type_pointer; break;
-        case LX::LangType::Void: sig_out_types = &ffi_type_void; break;
-        default                : sig_out_types = &ffi_type_sint; break;
-        }
+  switch (value->m_type)
+  {
+  case EX::Type::Int: word = value->as.m_int; return true;
+  case EX::Type::Str: word = (ssize_t)value->as.m_string.m_mem; return true;
+  default           : return false;
+  }
+}
 
-        auto sym = (DFN *)arena.alloc(sizeof(DFN));
-        *sym     = { t.as.ext_sym.def[0].as.string.m_mem,
-                     sig_in_types,
-                     sig_out_types };
+// NOTE: Exprs of ints, strings, locals that hold them, arithmetic and C calls.
+// They are evaluated on the env of the caller without copying it, so C calls
+// made from inside of a let or a loop do not allocate.
+static bool
+is_plain(
+  const EX::Expr &expr, const Env &env)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while evaluating (%s)",
+                UT_TCS(expr.m_type));
+  }
 
-        foreign_functions[std::to_string(t.as.ext_sym.name)] = sym;
-      }
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str: return true;
+  case EX::Type::Var:
+  {
+    UT::Sym sym = UT::symbol(expr.as.m_var);
+    auto    it  = env.find(sym);
+    if (env.end() == it) return foreign_functions.count(sym);
+    return EX::Type::Int == it->second.m_type
+           || EX::Type::Str == it->second.m_type;
+  }
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair = expr.as.m_pair;
+    return !fork_points.count(pair.begin()) && is_plain(pair.first(), env)
+           && is_plain(pair.second(), env);
+  }
+  case EX::Type::Minus:
+  case EX::Type::Not  : return is_plain(*expr.as.m_expr, env);
+  case EX::Type::VarApp:
+  {
+    UT::Sym sym = UT::symbol(expr.as.m_varapp.m_fn_name);
+    if (env.count(sym) || !foreign_functions.count(sym)) return false;
 
-      continue;
+    EX::Exprs params = expr.as.m_varapp.m_param;
+    for (const EX::Expr &param : params)
+    {
+      if (!is_plain(param, env)) return false;
     }
+    return true;
+  }
+  default: return false;
+  }
+}
 
-    UT::String def_name   = t.as.sym.name;
-    LX::Tokens def_tokens = t.as.sym.def;
+// NOTE: expr has to be plain, see is_plain
+static EX::Expr
+eval_plain(
+  const EX::Expr &expr, const Env &env)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while evaluating (%s)",
+                UT_TCS(expr.m_type));
+  }
 
-    EX::Parser parser{ def_tokens, arena, source_code.m_mem };
-    parser.run();
+  EX::Expr value{ EX::Type::Int };
+  switch (expr.m_type)
+  {
+  case EX::Type::Int:
+  case EX::Type::Str: return expr;
+  case EX::Type::Var:
+  {
+    UT::Sym sym = UT::symbol(expr.as.m_var);
+    auto    it  = env.find(sym);
+    if (env.end() != it) return it->second;
 
-    Instance instance{ *parser.m_exprs.last(), global_env };
-    instance                             = eval(instance);
-    global_env[std::to_string(def_name)] = instance.m_expr;
-    TL::Def def{ def_type, def_name, instance.m_expr };
+    DFN *foreign_fn = foreign_functions.find(sym)->second;
+    value.as.m_int  = call_foreign(foreign_fn, nullptr, 0);
+    return value;
+  }
+  case EX::Type::Add:
+  case EX::Type::Sub:
+  case EX::Type::Mult:
+  case EX::Type::Div:
+  case EX::Type::Modulus:
+  case EX::Type::IsEq:
+  {
+    UT::Pair<EX::Expr> pair  = expr.as.m_pair;
+    ssize_t            left  = eval_plain(pair.first(), env).as.m_int;
+    ssize_t            right = eval_plain(pair.second(), env).as.m_int;
+    switch (expr.m_type)
+    {
+    case EX::Type::Add    : value.as.m_int = left + right; break;
+    case EX::Type::Sub    : value.as.m_int = left - right; break;
+    case EX::Type::Mult   : value.as.m_int = left * right; break;
+    case EX::Type::Div    : value.as.m_int = left / right; break;
+    case EX::Type::Modulus: value.as.m_int = left % right; break;
+    default               : value.as.m_int = left == right; break;
+    }
+    return value;
+  }
+  case EX::Type::Minus:
+  {
+    value.as.m_int = -eval_plain(*expr.as.m_expr, env).as.m_int;
+    return value;
+  }
+  case EX::Type::Not:
+  {
+    value.as.m_int = !eval_plain(*expr.as.m_expr, env).as.m_int;
+    return value;
+  }
+  case EX::Type::VarApp:
+  {
+    ssize_t words[MAX_FOREIGN_ARGS];
+    size_t  argc = 0;
 
-    this->m_defs.push(def);
+    DFN *foreign_fn
+      = foreign_functions.find(UT::symbol(expr.as.m_varapp.m_fn_name))->second;
+    EX::Exprs params = expr.as.m_varapp.m_param;
+    check_foreign_args(foreign_fn, params.m_len);
 
-    if (!true)
+    for (const EX::Expr &param : params)
     {
-      std::printf("%s %s = %s\n",
-                  UT_TCS(def.m_type),
-                  UT_TCS(def_name),
-                  UT_TCS(global_env[std::to_string(def_name)]));
+      ssize_t word = 0;
+      foreign_word(eval_plain(param, env), env, word);
+      words[argc++] = word;
     }
+
+    value.as.m_int = call_foreign(foreign_fn, words, argc);
+    return value;
+  }
+  default: UT_FAIL_MSG("UNREACHABLE expr.m_type = %s", UT_TCS(expr.m_type));
   }
+  return value;
+}
 
-  for (auto it = global_env.begin(); it != global_env.end(); ++it)
+// NOTE: Runs left and right on the fork pool when at was planned as a fork
+// point and the forks are not nested too deep yet, else one after the other
+static void
+fork(
+  const EX::Expr *at, const PL::Pool::Fn &left, const PL::Pool::Fn &right)
+{
+  if (!fork_pool || fork_depth >= fork_limit || !fork_points.count(at))
   {
-    std::printf("INFO: %s -> %s\n", it->first.c_str(), UT_TCS(it->second));
+    left();
+    right();
+    return;
   }
 
-  DFN::deinit();
+  size_t depth = fork_depth + 1;
+  auto   nest  = [depth](const PL::Pool::Fn &fn) {
+    return [depth, &fn] {
+      size_t outer = fork_depth;
+      fork_depth   = depth;
+      fn();
+      fork_depth = outer;
+    };
+  };
+  fork_pool->fork_join(nest(left), nest(right));
 }
 
 static Instance
@@ -241,8 +1430,12 @@ eval_bi_op(
   Instance left_instance  = Instance{ expr.as.m_pair.first(), env };
   Instance right_instance = Instance{ expr.as.m_pair.second(), env };
 
-  ssize_t left  = eval(left_instance).m_expr.as.m_int;
-  ssize_t right = eval(right_instance).m_expr.as.m_int;
+  ssize_t left  = 0;
+  ssize_t right = 0;
+  fork(
+    expr.as.m_pair.begin(),
+    [&] { left = eval(left_instance).m_expr.as.m_int; },
+    [&] { right = eval(right_instance).m_expr.as.m_int; });
 
   Instance result_instance{ EX::Type::Int, env };
 
@@ -263,292 +1456,406 @@ Instance
 eval(
   Instance &inst)
 {
+  // NOTE: The env of inst is handed back with the result instead of copied
+  if (is_plain(inst.m_expr, inst.m_env))
+  {
+    EX::Expr value = eval_plain(inst.m_expr, inst.m_env);
+    return Instance{ value, std::move(inst.m_env) };
+  }
+
   EX::Expr expr = inst.m_expr;
   Env      env  = inst.m_env;
 
-  switch (expr.m_type)
-  {
-  case EX::Type::Add:
-  case EX::Type::Sub:
-  case EX::Type::Mult:
-  case EX::Type::Div:
-  case EX::Type::Modulus:
-  case EX::Type::IsEq   : return eval_bi_op(inst);
-  case EX::Type::Int    : return inst;
-  case EX::Type::Var:
+  if (UT::stack_exhausted())
   {
-    UT::String var_name = expr.as.m_var;
-    auto       var_expr = env.find(std::to_string(var_name));
+    UT_FAIL_MSG("Recursion limit exceeded while evaluating (%s)",
+                UT_TCS(expr.m_type));
+  }
 
-    if (var_expr != env.end())
+  // NOTE: Calls in tail position (the branches of an if, the continuation of a
+  // let and the body of an application) do not recurse, they replace expr and
+  // env and go around the loop. A VarApp hands its caller env back with the
+  // result, so the env of the outermost tail VarApp is kept for that.
+  Env  caller_env{};
+  bool tail_called = false;
+
+  auto done = [&](Instance result) {
+    if (tail_called) result.m_env = std::move(caller_env);
+    return result;
+  };
+
+  for (;;)
+  {
+    switch (expr.m_type)
     {
-      Instance new_instance{ var_expr->second, env };
-      return new_instance;
+    case EX::Type::Add:
+    case EX::Type::Sub:
+    case EX::Type::Mult:
+    case EX::Type::Div:
+    case EX::Type::Modulus:
+    case EX::Type::IsEq:
+    {
+      Instance bi_op_instance{ expr, env };
+      return done(eval_bi_op(bi_op_instance));
     }
-    else if (foreign_functions.end()
-             != foreign_functions.find(std::to_string(var_name)))
+    case EX::Type::Int: return done(Instance{ expr, env });
+    case EX::Type::Var:
     {
-      DFN foreign_fn = *foreign_functions.find(var_name.m_mem)->second;
-      foreign_fn.configure();
-      AR::Arena output_arena{};
-
-      // FIXME: assume output fits in 64 bytes
-      void *output = output_arena.alloc(64);
-
-      // The output might never be written to so 0 init
-      std::memset(output, 0, 64);
-      std::vector<void *> _input;
-
-      foreign_fn.call(_input, output);
+      UT::String var_name = expr.as.m_var;
+      UT::Sym    var_sym  = UT::symbol(var_name);
+      auto       var_expr = env.find(var_sym);
+      auto       var_fn   = foreign_functions.find(var_sym);
 
-      // FIXME: Don't assume the function only returns ints
-      EX::Expr int_expr{ EX::Type::Int };
-      int_expr.as.m_int = *(ssize_t *)output;
+      if (var_expr != env.end())
+      {
+        Instance new_instance{ var_expr->second, env };
+        return done(new_instance);
+      }
+      else if (foreign_functions.end() != var_fn)
+      {
+        // FIXME: Don't assume the function only returns ints
+        EX::Expr int_expr{ EX::Type::Int };
+        int_expr.as.m_int = call_foreign(var_fn->second, nullptr, 0);
 
-      Instance new_instance{ int_expr, env };
-      return new_instance;
+        Instance new_instance{ int_expr, std::move(env) };
+        return done(new_instance);
+      }
+      else
+      {
+        // FIXME: We should not fail like that
+        UT_FAIL_MSG("Variable (%s) is not defined", UT_TCS(var_name));
+      }
     }
-    else
+    break;
+    case EX::Type::Minus:
     {
-      // FIXME: We should not fail like that
-      UT_FAIL_MSG("Variable (%s) is not defined", UT_TCS(var_name));
+      Instance new_instance{ *expr.as.m_expr, env };
+      new_instance = eval(new_instance);
+      // TODO: this assumes the expression evaluates to an int, which is not
+      // always the case
+      new_instance.m_expr.as.m_int *= -1;
+      return done(new_instance);
     }
-  }
-  break;
-  case EX::Type::Minus:
-  {
-    Instance new_instance{ *expr.as.m_expr, env };
-    new_instance = eval(new_instance);
-    // TODO: this assumes the expression evaluates to an int, which is not
-    // always the case
-    new_instance.m_expr.as.m_int *= -1;
-    return new_instance;
-  }
-  break;
-  case EX::Type::FnApp:
-  {
-    EX::Exprs params = expr.as.m_fnapp.m_param;
-    EX::Expr  fndef  = expr;
-    Env       env    = inst.m_env;
-
-    for (EX::Expr &param_expr : params)
+    break;
+    case EX::Type::FnApp:
     {
-      Instance param_inst{ param_expr, env };
-      env[std::to_string(fndef.as.m_fn.m_param)] = eval(param_inst).m_expr;
-      fndef                                      = *fndef.as.m_fn.m_body;
-    }
-
-    Instance body_instance{ fndef, env };
-    body_instance = eval(body_instance);
-
-    return body_instance;
-  }
-  case EX::Type::FnDef:
-  {
-    return inst;
-  }
-  case EX::Type::VarApp:
-  {
-    std::string fn_name   = std::to_string(expr.as.m_varapp.m_fn_name);
-    auto        fn_def_it = env.find(fn_name);
-    EX::Expr    fndef{};
-    Env         app_env = env;
+      EX::Exprs params = expr.as.m_fnapp.m_param;
+      EX::Expr  fndef  = expr;
 
-    auto foreign_fn_it = foreign_functions.find(fn_name.c_str());
-
-    if (env.end() != fn_def_it)
-    {
-      fndef            = fn_def_it->second;
-      EX::Exprs params = expr.as.m_varapp.m_param;
       for (EX::Expr &param_expr : params)
       {
         Instance param_inst{ param_expr, env };
-        app_env[std::to_string(fndef.as.m_fn.m_param)]
-          = eval(param_inst).m_expr;
-
-        // NOTE: Pop the parameter
-        fndef = *fndef.as.m_fn.m_body;
+        env[UT::symbol(fndef.as.m_fn.m_param)] = eval(param_inst).m_expr;
+        fndef                                      = *fndef.as.m_fn.m_body;
       }
 
-      Instance app_instance{ fndef, app_env };
-      app_instance       = eval(app_instance); // NOTE: remove app env
-      app_instance.m_env = env;
-
-      return app_instance;
+      expr = fndef;
+      continue;
     }
-    // TODO: There should be a better way to both load and define functions
-    else if (foreign_functions.end() != foreign_fn_it)
+    case EX::Type::FnDef:
     {
-      DFN foreign_fn = *foreign_functions.find(fn_name.c_str())->second;
-      foreign_fn.configure();
-
-      AR::Arena           input_buffer{};
-      std::vector<void *> input;
+      return done(Instance{ expr, env });
+    }
+    case EX::Type::VarApp:
+    {
+      UT::String fn_name   = UT::intern(expr.as.m_varapp.m_fn_name);
+      auto       fn_def_it = env.find(fn_name.m_sym);
+      EX::Expr   fndef{};
 
-      // FIXME: assume output fits in 64 bytes
-      void *output = input_buffer.alloc(64);
+      auto foreign_fn_it = foreign_functions.find(fn_name.m_sym);
 
-      EX::Exprs params = expr.as.m_varapp.m_param;
-      for (auto &param_expr : params)
+      if (env.end() != fn_def_it)
       {
-        Instance param_inst{ param_expr, env };
-        param_inst = eval(param_inst);
+        fndef            = fn_def_it->second;
+        EX::Exprs params = expr.as.m_varapp.m_param;
+
+        std::vector<EX::Expr> args{};
+        for (EX::Expr &param_expr : params)
+        {
+          Instance param_inst{ param_expr, env };
+          args.push_back(eval(param_inst).m_expr);
+        }
 
-        if (EX::Type::Int == param_inst.m_expr.m_type)
+        auto native_it = EX::Type::FnDef == fndef.m_type
+                           ? native_functions.find(fndef.as.m_fn.m_body)
+                           : native_functions.end();
+        if (native_functions.end() != native_it)
         {
-          ssize_t param = param_inst.m_expr.as.m_int;
+          std::vector<RS::Value> native_args{};
+          for (EX::Expr &arg : args)
+          {
+            if (EX::Type::Int != arg.m_type) break;
+            native_args.push_back(RS::Value{ arg.as.m_int });
+          }
+
+          RS::Value result{};
+          if (native_args.size() == args.size()
+              && JT::Native::Done
+                   == JT::try_call(*native_it->second,
+                                   native_args.data(),
+                                   args.size(),
+                                   result))
+          {
+            Instance app_instance{ EX::Type::Int, env };
+            app_instance.m_expr.as.m_int = result.as.m_int;
+            return done(app_instance);
+          }
+        }
+
+        bool memoize = memo_table && EX::Type::FnDef == fndef.m_type
+                       && pure_functions.count(fndef.as.m_fn.m_body)
+                       && args.size() <= MM::MAX_ARGS;
+
+        ssize_t memo_args[MM::MAX_ARGS];
+        for (size_t i = 0; memoize && i < args.size(); ++i)
+        {
+          memoize      = EX::Type::Int == args[i].m_type;
+          memo_args[i] = args[i].as.m_int;
+        }
+
+        const EX::Expr *memo_key = memoize ? fndef.as.m_fn.m_body : nullptr;
+        Env             app_env  = env;
+        for (EX::Expr &arg : args)
+        {
+          app_env[UT::symbol(fndef.as.m_fn.m_param)] = arg;
 
-          void *param_buffer      = input_buffer.alloc<ssize_t>(1);
-          *(size_t *)param_buffer = param;
-          input.push_back(param_buffer);
+          // NOTE: Pop the parameter
+          fndef = *fndef.as.m_fn.m_body;
         }
-        else if (EX::Type::Str == param_inst.m_expr.m_type)
+
+        // NOTE: Only a full application of a pure fn is cached
+        if (memoize && EX::Type::FnDef != fndef.m_type)
         {
-          char *param = param_inst.m_expr.as.m_string.m_mem;
+          Instance app_instance{ EX::Type::Int, env };
+          {
+            std::lock_guard<std::mutex> lock{ memo_mutex };
+            if (memo_table->find(memo_key,
+                                 memo_args,
+                                 args.size(),
+                                 app_instance.m_expr.as.m_int))
+            {
+              return done(app_instance);
+            }
+          }
 
-          void *param_buffer     = input_buffer.alloc<ssize_t>(1);
-          *(char **)param_buffer = param;
-          input.push_back(param_buffer);
+          Instance body_instance{ fndef, app_env };
+          app_instance.m_expr = eval(body_instance).m_expr;
+          if (EX::Type::Int == app_instance.m_expr.m_type)
+          {
+            std::lock_guard<std::mutex> lock{ memo_mutex };
+            memo_table->insert(
+              memo_key, memo_args, args.size(), app_instance.m_expr.as.m_int);
+          }
+          return done(app_instance);
         }
-        else
+
+        // NOTE: The app env is dropped once the call returns
+        if (!tail_called)
         {
-          UT_TODO();
+          caller_env  = env;
+          tail_called = true;
         }
+        expr = fndef;
+        env  = std::move(app_env);
+        continue;
       }
+      // TODO: There should be a better way to both load and define functions
+      else if (foreign_functions.end() != foreign_fn_it)
+      {
+        // NOTE: No allocation from here on for args that are literals or
+        // locals, the args and the result stay on the stack
+        ssize_t words[MAX_FOREIGN_ARGS];
+        size_t  argc = 0;
+
+        EX::Exprs params = expr.as.m_varapp.m_param;
+        check_foreign_args(foreign_fn_it->second, params.m_len);
+
+        for (auto &param_expr : params)
+        {
+          ssize_t word = 0;
+          if (is_plain(param_expr, env))
+          {
+            foreign_word(eval_plain(param_expr, env), env, word);
+          }
+          else if (!foreign_word(param_expr, env, word))
+          {
+            Instance param_inst{ param_expr, env };
+            param_inst = eval(param_inst);
+            if (!foreign_word(param_inst.m_expr, env, word)) UT_TODO();
+          }
+          words[argc++] = word;
+        }
 
-      bool ok = foreign_fn.call(input, output);
-      (void)ok;
+        ssize_t output = call_foreign(foreign_fn_it->second, words, argc);
 
-      Instance app_instance{ fndef, env };
-      app_instance.m_expr.m_type   = EX::Type::Int;
-      app_instance.m_expr.as.m_int = *(ssize_t *)output;
+        Instance app_instance{ fndef, std::move(env) };
+        app_instance.m_expr.m_type   = EX::Type::Int;
+        app_instance.m_expr.as.m_int = output;
 
-      return app_instance;
-    }
-    else
-    {
-      // TODO: Use DFN class
-      void *handle = dlopen("./bin/bc.so", RTLD_LAZY | RTLD_DEEPBIND);
-      void *fn     = dlsym(handle, fn_name.c_str());
+        return done(app_instance);
+      }
+      else
+      {
+        // TODO: Use DFN class
+        if (!fallback_library)
+        {
+          fallback_library = FF::Libraries::open(UT::String{ "./bin/bc.so" });
+        }
+        void *fn = FF::Libraries::find(fallback_library, fn_name);
+        if (!fn) UT_FAIL_MSG("ERROR: function (%s) not found\n", fn_name.m_mem);
+
+        int ret = 0;
+
+        EX::Expr *app_param = expr.as.m_varapp.m_param.last();
+        ssize_t   param
+          = EX::Type::Var == app_param->m_type
+              ? (ssize_t)env[UT::symbol(app_param->as.m_var)].as.m_string.m_mem
+              : app_param->as.m_int;
 
-      int ret = 0;
+        /* libffi setup */
+        ffi_cif   cif;
+        ffi_type *arg_types[1] = { &ffi_type_sint64 };
+        ffi_type *ret_type     = &ffi_type_sint;
 
-      EX::Expr *app_param = expr.as.m_varapp.m_param.last();
-      ssize_t   param
-        = EX::Type::Var == app_param->m_type
-            ? (ssize_t)env[std::string(app_param->as.m_varapp.m_fn_name.m_mem)]
-                .as.m_string.m_mem
-            : app_param->as.m_int;
+        ssize_t ffi_result
+          = ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, ret_type, arg_types);
 
-      /* libffi setup */
-      ffi_cif   cif;
-      ffi_type *arg_types[1] = { &ffi_type_sint64 };
-      ffi_type *ret_type     = &ffi_type_sint;
+        if (FFI_OK != ffi_result)
+        {
+          UT_FAIL_MSG("LIB FFI call failed with %zu\n", ffi_result);
+          // FIXME: handle error
+        }
 
-      ssize_t ffi_result
-        = ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, ret_type, arg_types);
+        void *args[1] = { &param };
+        ffi_call(&cif, FFI_FN(fn), &ret, args);
 
-      if (FFI_OK != ffi_result)
+        Instance app_instance{ fndef, env };
+        app_instance.m_expr.m_type   = EX::Type::Int;
+        app_instance.m_expr.as.m_int = ret;
+
+        return done(app_instance);
+      }
+    }
+    case EX::Type::If:
+    {
+      bool condition = false;
+      if (is_plain(*expr.as.m_if.m_condition, env))
+      {
+        condition = eval_plain(*expr.as.m_if.m_condition, env).as.m_int;
+      }
+      else
       {
-        UT_FAIL_MSG("LIB FFI call failed with %zu\n", ffi_result);
-        // FIXME: handle error
+        Instance cond_instance{ *expr.as.m_if.m_condition, env };
+        condition = eval(cond_instance).m_expr.as.m_int;
       }
 
-      void *args[1] = { &param };
-      ffi_call(&cif, FFI_FN(fn), &ret, args);
+      expr = condition ? *expr.as.m_if.m_true_branch
+                       : *expr.as.m_if.m_else_branch;
+      continue;
+    }
+    case EX::Type::Let:
+    {
+      UT::String var_name = expr.as.m_let.m_var_name;
 
-      dlclose(handle);
+      if (!fork_points.count(expr.as.m_let.m_value)
+          && is_plain(*expr.as.m_let.m_value, env))
+      {
+        env[UT::symbol(var_name)] = eval_plain(*expr.as.m_let.m_value, env);
+        expr                      = *expr.as.m_let.m_continuation;
+        continue;
+      }
 
-      Instance app_instance{ fndef, env };
-      app_instance.m_expr.m_type   = EX::Type::Int;
-      app_instance.m_expr.as.m_int = ret;
+      Instance value_instance{ *expr.as.m_let.m_value, env };
 
-      return app_instance;
-    }
-  }
-  case EX::Type::If:
-  {
-    Instance cond_instance{ *expr.as.m_if.m_condition, env };
-    Instance true_instance{ *expr.as.m_if.m_true_branch, env };
-    Instance else_instance{ *expr.as.m_if.m_else_branch, env };
+      // NOTE: The value of the next let does not read this one, see plan_forks
+      if (fork_pool && fork_points.count(expr.as.m_let.m_value))
+      {
+        EX::Let  next = expr.as.m_let.m_continuation->as.m_let;
+        Instance next_instance{ *next.m_value, env };
 
-    return eval(cond_instance).m_expr.as.m_int ? eval(true_instance)
-                                               : eval(else_instance);
-  }
-  case EX::Type::Let:
-  {
-    UT::String var_name = expr.as.m_let.m_var_name;
-    Instance   value_instance{ *expr.as.m_let.m_value, env };
-    value_instance = eval(value_instance);
+        fork(
+          expr.as.m_let.m_value,
+          [&] { value_instance = eval(value_instance); },
+          [&] { next_instance = eval(next_instance); });
 
-    Env local_env                       = env;
-    local_env[std::to_string(var_name)] = value_instance.m_expr;
+        env[UT::symbol(var_name)]        = value_instance.m_expr;
+        env[UT::symbol(next.m_var_name)] = next_instance.m_expr;
 
-    Instance continuation_instrance{ *expr.as.m_let.m_continuation, local_env };
+        expr = *next.m_continuation;
+        continue;
+      }
 
-    return eval(continuation_instrance);
-  }
-  case EX::Type::Not:
-  {
-    Instance inner_instance{ *expr.as.m_expr, env };
-    inner_instance       = eval(inner_instance);
-    ssize_t &inner_value = inner_instance.m_expr.as.m_int;
-    inner_value          = not inner_value;
+      value_instance = eval(value_instance);
 
-    return inner_instance;
-  }
-  case EX::Type::Str:
-  {
-    return inst;
-  }
-  break;
-  case EX::Type::While:
-  {
-    Instance return_instance        = { EX::Expr{ EX::Type::Int }, env };
-    Env      while_env              = env;
-    return_instance.m_expr.as.m_int = 0;
+      env[UT::symbol(var_name)] = value_instance.m_expr;
 
-    EX::Expr condition_expr = *expr.as.m_while.m_condition;
-    EX::Expr body_expr      = *expr.as.m_while.m_body;
-    Instance condition_instance{ condition_expr, while_env };
-    Instance body_instance{ body_expr, while_env };
+      expr = *expr.as.m_let.m_continuation;
+      continue;
+    }
+    case EX::Type::Not:
+    {
+      Instance inner_instance{ *expr.as.m_expr, env };
+      inner_instance       = eval(inner_instance);
+      ssize_t &inner_value = inner_instance.m_expr.as.m_int;
+      inner_value          = not inner_value;
 
-  TL_CONDITION_BLOCK:
-  {
-    condition_instance = { condition_expr, while_env };
-    condition_instance = eval(condition_instance);
-    while_env          = condition_instance.m_env;
-    if (EX::Type::Int != condition_instance.m_expr.m_type)
+      return done(inner_instance);
+    }
+    case EX::Type::Str:
     {
-      UT_FAIL_MSG("Expected integer(bool) but found %s\n", UT_TCS(expr.m_type));
+      return done(Instance{ expr, env });
     }
-    bool should_loop = condition_instance.m_expr.as.m_int;
+    break;
+    case EX::Type::While:
+    {
+      Instance return_instance        = { EX::Expr{ EX::Type::Int }, env };
+      Env      while_env              = env;
+      return_instance.m_expr.as.m_int = 0;
 
-    if (should_loop)
-      goto TL_BODY_EVAL_BLOCK;
-    else
-      goto TL_RETURN_BLOCK;
-  }
+      EX::Expr condition_expr = *expr.as.m_while.m_condition;
+      EX::Expr body_expr      = *expr.as.m_while.m_body;
+      Instance condition_instance{ condition_expr, while_env };
+      Instance body_instance{ body_expr, while_env };
 
-  TL_BODY_EVAL_BLOCK:
-  {
-    body_instance = { body_expr, while_env };
-    body_instance = eval(body_instance);
-    while_env     = body_instance.m_env;
+    TL_CONDITION_BLOCK:
+    {
+      next_frame();
+      condition_instance = { condition_expr, std::move(while_env) };
+      condition_instance = eval(condition_instance);
+      while_env          = std::move(condition_instance.m_env);
+      if (EX::Type::Int != condition_instance.m_expr.m_type)
+      {
+        UT_FAIL_MSG("Expected integer(bool) but found %s\n",
+                    UT_TCS(expr.m_type));
+      }
+      bool should_loop = condition_instance.m_expr.as.m_int;
 
-    goto TL_CONDITION_BLOCK;
-  }
+      if (should_loop)
+        goto TL_BODY_EVAL_BLOCK;
+      else
+        goto TL_RETURN_BLOCK;
+    }
 
-  TL_RETURN_BLOCK:
-    return return_instance;
-  }
-  break;
-  case EX::Type::Unknown:
-  default:
-  {
-    UT_FAIL_MSG("Type <%s> not supported yet\n", UT_TCS(expr.m_type));
-  }
-  break;
+    TL_BODY_EVAL_BLOCK:
+    {
+      body_instance = { body_expr, std::move(while_env) };
+      body_instance = eval(body_instance);
+      while_env     = std::move(body_instance.m_env);
+
+      goto TL_CONDITION_BLOCK;
+    }
+
+    TL_RETURN_BLOCK:
+      return done(return_instance);
+    }
+    break;
+    case EX::Type::Unknown:
+    default:
+    {
+      UT_FAIL_MSG("Type <%s> not supported yet\n", UT_TCS(expr.m_type));
+    }
+    break;
+    }
   }
 
   UT_FAIL_MSG("Expr type not resolved, type = %s", expr.m_type);
@@ -0,0 +1,719 @@
+/*-------------------------------------------------------------------------------
+ *\file VM.cpp
+ *\info Bytecode compiler and stack machine impl
+ * *----------------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------------------
+ *\INCLUDES
+ *-----------------------------------------------------------------------------*/
+
+#include "VM.hpp"
+#include "JT.hpp"
+#include "RS.hpp"
+#include "TL.hpp"
+#include "UT.hpp"
+#include <algorithm>
+#include <vector>
+
+namespace VM
+{
+
+namespace
+/*-------------------------------------------------------------------------------
+ *\UTILS
+ *------------------------------------------------------------------------------*/
+{
+
+int32_t
+stack_effect(
+  Op op, uint16_t argc)
+{
+  switch (op)
+  {
+  case Op::Const:
+  case Op::Load:
+  case Op::LoadGlobal : return 1;
+  case Op::Store:
+  case Op::Pop:
+  case Op::Add:
+  case Op::Sub:
+  case Op::Mult:
+  case Op::Div:
+  case Op::Modulus:
+  case Op::IsEq:
+  case Op::JumpIfNot:
+  case Op::Return     : return -1;
+  case Op::Minus:
+  case Op::Not:
+  case Op::Jump:
+  case Op::NextFrame  : return 0;
+  case Op::Call:
+  case Op::TailCall   : return -(int32_t)argc;
+  case Op::CallGlobal:
+  case Op::TailCallGlobal:
+  case Op::CallForeign: return 1 - (int32_t)argc;
+  }
+  UT_FAIL_IF("UNREACHABLE");
+  return 0;
+}
+
+inline ssize_t
+as_int(
+  const RS::Value &value)
+{
+  if (RS::Kind::Int != value.m_kind)
+  {
+    UT_FAIL_MSG("Expected an integer but found %s", UT_TCS(value));
+  }
+  return value.as.m_int;
+}
+
+void
+collect_protos(
+  const RS::Node *node, std::vector<const RS::Proto *> &protos)
+{
+  switch (node->m_op)
+  {
+  case RS::Op::Int:
+  case RS::Op::Str:
+  case RS::Op::Local:
+  case RS::Op::Global: break;
+  case RS::Op::Lambda:
+  {
+    protos.push_back(node->as.m_proto);
+    collect_protos(node->as.m_proto->m_body, protos);
+  }
+  break;
+  case RS::Op::Call:
+  {
+    collect_protos(node->as.m_call.m_callee, protos);
+    for (uint32_t i = 0; i < node->as.m_call.m_argc; ++i)
+    {
+      collect_protos(node->as.m_call.m_args[i], protos);
+    }
+  }
+  break;
+  case RS::Op::ForeignCall:
+  {
+    for (uint32_t i = 0; i < node->as.m_foreign.m_argc; ++i)
+    {
+      collect_protos(node->as.m_foreign.m_args[i], protos);
+    }
+  }
+  break;
+  case RS::Op::Add:
+  case RS::Op::Sub:
+  case RS::Op::Mult:
+  case RS::Op::Div:
+  case RS::Op::Modulus:
+  case RS::Op::IsEq:
+  {
+    collect_protos(node->as.m_bin.m_left, protos);
+    collect_protos(node->as.m_bin.m_right, protos);
+  }
+  break;
+  case RS::Op::Minus:
+  case RS::Op::Not  : collect_protos(node->as.m_operand, protos); break;
+  case RS::Op::If:
+  {
+    collect_protos(node->as.m_if.m_condition, protos);
+    collect_protos(node->as.m_if.m_true_branch, protos);
+    collect_protos(node->as.m_if.m_else_branch, protos);
+  }
+  break;
+  case RS::Op::Let:
+  {
+    collect_protos(node->as.m_let.m_value, protos);
+    collect_protos(node->as.m_let.m_continuation, protos);
+  }
+  break;
+  case RS::Op::While:
+  {
+    collect_protos(node->as.m_while.m_condition, protos);
+    collect_protos(node->as.m_while.m_body, protos);
+  }
+  break;
+  }
+}
+
+} // namespace
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Compiler)
+ *------------------------------------------------------------------------------*/
+
+Compiler::Compiler(
+  AR::Arena &arena)
+    : m_arena{ arena },
+      m_ok{ true },
+      m_depth{ 0 },
+      m_max_depth{ 0 }
+{
+}
+
+size_t
+Compiler::emit(
+  Op op, uint32_t arg, uint16_t argc)
+{
+  this->m_code.push_back(Instr{ op, argc, arg });
+
+  this->m_depth += stack_effect(op, argc);
+  if (this->m_depth > this->m_max_depth) this->m_max_depth = this->m_depth;
+
+  return this->m_code.size() - 1;
+}
+
+void
+Compiler::patch(
+  size_t at)
+{
+  this->m_code[at].m_arg = this->m_code.size();
+}
+
+void
+Compiler::lower(
+  const RS::Node *node, bool tail)
+{
+  if (UT::stack_exhausted())
+  {
+    UT_FAIL_MSG("Recursion limit exceeded while compiling (%s)",
+                UT_TCS(node->m_op));
+  }
+
+  if (!this->m_ok) return;
+
+  switch (node->m_op)
+  {
+  case RS::Op::Int:
+  {
+    this->m_consts.push_back(RS::Value{ node->as.m_int });
+    this->emit(Op::Const, this->m_consts.size() - 1);
+  }
+  break;
+  case RS::Op::Str:
+  {
+    this->m_consts.push_back(RS::Value{ node->as.m_string });
+    this->emit(Op::Const, this->m_consts.size() - 1);
+  }
+  break;
+  case RS::Op::Local:
+  {
+    // NOTE: Frames of enclosing functions are not on the value stack
+    if (0 != node->as.m_local.m_depth)
+    {
+      this->m_ok = false;
+      return;
+    }
+    this->emit(Op::Load, node->as.m_local.m_slot);
+  }
+  break;
+  case RS::Op::Global:
+  {
+    this->emit(Op::LoadGlobal, node->as.m_global);
+  }
+  break;
+  case RS::Op::Lambda:
+  {
+    const RS::Proto *proto = node->as.m_proto;
+    if (proto->m_captures)
+    {
+      this->m_ok = false;
+      return;
+    }
+    this->m_consts.push_back(RS::Value{ RS::Closure{ proto, nullptr, nullptr } });
+    this->emit(Op::Const, this->m_consts.size() - 1);
+  }
+  break;
+  case RS::Op::Call:
+  {
+    const RS::Call &call = node->as.m_call;
+
+    if (RS::Op::Global == call.m_callee->m_op)
+    {
+      for (uint32_t i = 0; i < call.m_argc; ++i) this->lower(call.m_args[i]);
+      this->emit(tail ? Op::TailCallGlobal : Op::CallGlobal,
+                 call.m_callee->as.m_global,
+                 call.m_argc);
+    }
+    else
+    {
+      this->lower(call.m_callee);
+      for (uint32_t i = 0; i < call.m_argc; ++i) this->lower(call.m_args[i]);
+      this->emit(tail ? Op::TailCall : Op::Call, 0, call.m_argc);
+    }
+  }
+  break;
+  case RS::Op::ForeignCall:
+  {
+    const RS::ForeignCall &call = node->as.m_foreign;
+    for (uint32_t i = 0; i < call.m_argc; ++i) this->lower(call.m_args[i]);
+
+    this->m_foreign.push_back(call.m_fn);
+    this->emit(Op::CallForeign, this->m_foreign.size() - 1, call.m_argc);
+  }
+  break;
+  case RS::Op::Add:
+  case RS::Op::Sub:
+  case RS::Op::Mult:
+  case RS::Op::Div:
+  case RS::Op::Modulus:
+  case RS::Op::IsEq:
+  {
+    this->lower(node->as.m_bin.m_left);
+    this->lower(node->as.m_bin.m_right);
+
+    switch (node->m_op)
+    {
+    case RS::Op::Add    : this->emit(Op::Add); break;
+    case RS::Op::Sub    : this->emit(Op::Sub); break;
+    case RS::Op::Mult   : this->emit(Op::Mult); break;
+    case RS::Op::Div    : this->emit(Op::Div); break;
+    case RS::Op::Modulus: this->emit(Op::Modulus); break;
+    case RS::Op::IsEq   : this->emit(Op::IsEq); break;
+    default             : UT_FAIL_IF("UNREACHABLE");
+    }
+  }
+  break;
+  case RS::Op::Minus:
+  {
+    this->lower(node->as.m_operand);
+    this->emit(Op::Minus);
+  }
+  break;
+  case RS::Op::Not:
+  {
+    this->lower(node->as.m_operand);
+    this->emit(Op::Not);
+  }
+  break;
+  case RS::Op::If:
+  {
+    const RS::If &if_else = node->as.m_if;
+
+    this->lower(if_else.m_condition);
+    size_t to_else = this->emit(Op::JumpIfNot);
+    int32_t depth   = this->m_depth;
+
+    this->lower(if_else.m_true_branch, tail);
+    size_t to_end = this->emit(Op::Jump);
+
+    this->patch(to_else);
+    this->m_depth = depth;
+    this->lower(if_else.m_else_branch, tail);
+    this->patch(to_end);
+  }
+  break;
+  case RS::Op::Let:
+  {
+    const RS::Let &let = node->as.m_let;
+    if (0 != let.m_target.m_depth)
+    {
+      this->m_ok = false;
+      return;
+    }
+
+    this->lower(let.m_value);
+    this->emit(Op::Store, let.m_target.m_slot);
+    this->lower(let.m_continuation, tail);
+  }
+  break;
+  case RS::Op::While:
+  {
+    const RS::While &whyle = node->as.m_while;
+
+    for (uint32_t i = 0; i < whyle.m_carried_len; ++i)
+    {
+      if (0 != whyle.m_carried_from[i].m_depth)
+      {
+        this->m_ok = false;
+        return;
+      }
+      this->emit(Op::Load, whyle.m_carried_from[i].m_slot);
+      this->emit(Op::Store, whyle.m_carried_to[i]);
+    }
+
+    uint32_t condition = this->m_code.size();
+    this->emit(Op::NextFrame);
+    this->lower(whyle.m_condition);
+    size_t to_end = this->emit(Op::JumpIfNot);
+
+    this->lower(whyle.m_body);
+    this->emit(Op::Pop);
+    this->emit(Op::Jump, condition);
+
+    this->patch(to_end);
+    this->m_consts.push_back(RS::Value{ (ssize_t)0 });
+    this->emit(Op::Const, this->m_consts.size() - 1);
+  }
+  break;
+  }
+}
+
+Chunk *
+Compiler::compile(
+  const RS::Proto &proto)
+{
+  this->m_code.clear();
+  this->m_consts.clear();
+  this->m_foreign.clear();
+  this->m_ok        = true;
+  this->m_depth     = 0;
+  this->m_max_depth = 0;
+
+  this->lower(proto.m_body, true);
+  this->emit(Op::Return);
+
+  if (!this->m_ok) return nullptr;
+
+  Chunk *chunk = (Chunk *)this->m_arena.alloc<Chunk>();
+  chunk->m_proto     = &proto;
+  chunk->m_arity     = proto.m_arity;
+  chunk->m_frame_len = proto.m_frame_len;
+  chunk->m_max_stack = this->m_max_depth;
+  chunk->m_len       = this->m_code.size();
+
+  chunk->m_code = (Instr *)this->m_arena.alloc<Instr>(chunk->m_len);
+  std::memcpy(chunk->m_code, this->m_code.data(), chunk->m_len * sizeof(Instr));
+
+  chunk->m_consts
+    = (RS::Value *)this->m_arena.alloc<RS::Value>(this->m_consts.size());
+  for (size_t i = 0; i < this->m_consts.size(); ++i)
+  {
+    chunk->m_consts[i] = this->m_consts[i];
+  }
+
+  chunk->m_foreign
+    = (TL::DFN **)this->m_arena.alloc<TL::DFN *>(this->m_foreign.size());
+  for (size_t i = 0; i < this->m_foreign.size(); ++i)
+  {
+    chunk->m_foreign[i] = this->m_foreign[i];
+  }
+
+  return chunk;
+}
+
+/*-------------------------------------------------------------------------------
+ *\IMPL (Machine)
+ *------------------------------------------------------------------------------*/
+
+Machine::Machine(
+  AR::Arena &arena, RS::Globals &globals, size_t max_frames)
+    : m_arena{ arena },
+      m_globals{ globals },
+      m_fallback{ arena, globals },
+      m_max_frames{ max_frames },
+      m_compiler{ arena },
+      m_stack_len{ STACK_LEN },
+      m_native_depth{ SIZE_MAX }
+{
+  this->m_stack = (RS::Value *)std::malloc(STACK_LEN * sizeof(RS::Value));
+}
+
+Machine::~Machine()
+{
+  std::free(this->m_stack);
+}
+
+const Chunk *
+Machine::chunk(
+  const RS::Proto &proto)
+{
+  if (proto.m_chunk) return proto.m_chunk;
+  if (proto.m_uncompilable) return nullptr;
+
+  proto.m_chunk        = this->m_compiler.compile(proto);
+  proto.m_uncompilable = !proto.m_chunk;
+
+  return proto.m_chunk;
+}
+
+void
+Machine::prepare(
+  const RS::Proto &def)
+{
+  std::vector<const RS::Proto *> protos{ &def };
+  collect_protos(def.m_body, protos);
+
+  for (const RS::Proto *proto : protos) this->chunk(*proto);
+}
+
+void
+Machine::grow(
+  size_t len)
+{
+  size_t stack_len = this->m_stack_len;
+  while (stack_len < len) stack_len *= 2;
+
+  auto stack = (RS::Value *)std::realloc(this->m_stack,
+                                         stack_len * sizeof(RS::Value));
+  if (!stack)
+  {
+    UT_FAIL_MSG("Could not grow the VM stack to %zu values", stack_len);
+  }
+
+  this->m_stack     = stack;
+  this->m_stack_len = stack_len;
+}
+
+RS::Value
+Machine::run(
+  const RS::Proto &def)
+{
+  const Chunk *entry = this->chunk(def);
+  if (!entry) return this->m_fallback.run(def);
+
+  size_t len = entry->m_frame_len + entry->m_max_stack;
+  if (len > this->m_stack_len) this->grow(len);
+
+  this->m_frames.clear();
+  this->m_frames.push_back(CallFrame{ entry, entry->m_code, 0, 0 });
+  this->m_native_depth = SIZE_MAX;
+
+  return this->execute();
+}
+
+RS::Value
+Machine::execute()
+{
+  CallFrame   *frame  = &this->m_frames.back();
+  const Chunk *chunk  = frame->m_chunk;
+  const Instr *ip     = frame->m_ip;
+  RS::Value   *stack  = this->m_stack;
+  RS::Value   *base   = stack + frame->m_base;
+  RS::Value   *sp     = base + chunk->m_frame_len;
+  RS::Globals &global = this->m_globals;
+
+  for (;;)
+  {
+    const Instr &instr = *ip++;
+
+    switch (instr.m_op)
+    {
+    case Op::Const: *sp++ = chunk->m_consts[instr.m_arg]; break;
+    case Op::Load : *sp++ = base[instr.m_arg]; break;
+    case Op::Store: base[instr.m_arg] = *--sp; break;
+    case Op::Pop  : --sp; break;
+    case Op::LoadGlobal:
+    {
+      if (!global.m_defined[instr.m_arg])
+      {
+        UT_FAIL_MSG("Variable (%s) is not defined",
+                    UT_TCS(global.m_names[instr.m_arg]));
+      }
+      *sp++ = global.m_values[instr.m_arg];
+    }
+    break;
+    case Op::Add:
+    {
+      ssize_t right = as_int(*--sp);
+      sp[-1]        = RS::Value{ as_int(sp[-1]) + right };
+    }
+    break;
+    case Op::Sub:
+    {
+      ssize_t right = as_int(*--sp);
+      sp[-1]        = RS::Value{ as_int(sp[-1]) - right };
+    }
+    break;
+    case Op::Mult:
+    {
+      ssize_t right = as_int(*--sp);
+      sp[-1]        = RS::Value{ as_int(sp[-1]) * right };
+    }
+    break;
+    case Op::Div:
+    {
+      ssize_t right = as_int(*--sp);
+      sp[-1]        = RS::Value{ as_int(sp[-1]) / right };
+    }
+    break;
+    case Op::Modulus:
+    {
+      ssize_t right = as_int(*--sp);
+      sp[-1]        = RS::Value{ as_int(sp[-1]) % right };
+    }
+    break;
+    case Op::IsEq:
+    {
+      ssize_t right = as_int(*--sp);
+      sp[-1]        = RS::Value{ (ssize_t)(as_int(sp[-1]) == right) };
+    }
+    break;
+    case Op::Minus: sp[-1] = RS::Value{ -as_int(sp[-1]) }; break;
+    case Op::Not  : sp[-1] = RS::Value{ (ssize_t)!as_int(sp[-1]) }; break;
+    case Op::Jump : ip = chunk->m_code + instr.m_arg; break;
+    case Op::JumpIfNot:
+    {
+      if (!as_int(*--sp)) ip = chunk->m_code + instr.m_arg;
+    }
+    break;
+    case Op::NextFrame: TL::next_frame(); break;
+    case Op::Call:
+    case Op::CallGlobal:
+    case Op::TailCall:
+    case Op::TailCallGlobal:
+    {
+      RS::Value *args      = sp - instr.m_argc;
+      RS::Value *return_sp = args;
+      RS::Value  fn{};
+
+      if (Op::Call == instr.m_op || Op::TailCall == instr.m_op)
+      {
+        fn        = args[-1];
+        return_sp = args - 1;
+      }
+      else
+      {
+        if (!global.m_defined[instr.m_arg])
+        {
+          UT_FAIL_MSG("Variable (%s) is not defined",
+                      UT_TCS(global.m_names[instr.m_arg]));
+        }
+        fn = global.m_values[instr.m_arg];
+      }
+
+      if (RS::Kind::Fn != fn.m_kind)
+      {
+        UT_FAIL_MSG("Expected a function but found %s", UT_TCS(fn));
+      }
+
+      const RS::Closure &closure = fn.as.m_fn;
+      const Chunk       *callee  = nullptr;
+      if (!closure.m_partial && instr.m_argc == closure.m_proto->m_arity)
+      {
+        RS::Value  result{};
+        JT::Native native = JT::Native::Skipped;
+        if (this->m_frames.size() < this->m_native_depth)
+        {
+          native = JT::try_call(*closure.m_proto, args, instr.m_argc, result);
+        }
+        if (JT::Native::Done == native)
+        {
+          sp    = return_sp;
+          *sp++ = result;
+          break;
+        }
+        // NOTE: Native code that ran out of stack would run out again for
+        // every call made deeper than this one, so those are left to the
+        // bytecode
+        if (JT::Native::Overflowed == native)
+        {
+          this->m_native_depth = this->m_frames.size();
+        }
+        // NOTE: Pure fns are memoized by the frame runtime
+        bool memo = closure.m_proto->m_memo && this->m_fallback.m_memo;
+        if (!memo) callee = this->chunk(*closure.m_proto);
+      }
+
+      if (!callee)
+      {
+        // NOTE: Partial and over application go through the frame runtime
+        RS::Value result = this->m_fallback.apply(fn, args, instr.m_argc);
+        sp               = return_sp;
+        *sp++            = result;
+        break;
+      }
+
+      // NOTE: A tail call takes over the frame of the caller, the args are
+      // moved down to its base and it returns to where the caller would have
+      if (Op::TailCall == instr.m_op || Op::TailCallGlobal == instr.m_op)
+      {
+        size_t len
+          = (base - stack) + callee->m_frame_len + callee->m_max_stack;
+        if (len > this->m_stack_len)
+        {
+          size_t base_at = base - stack;
+          size_t args_at = args - stack;
+
+          this->grow(len);
+          stack = this->m_stack;
+          base  = stack + base_at;
+          args  = stack + args_at;
+        }
+
+        for (uint16_t i = 0; i < instr.m_argc; ++i) base[i] = args[i];
+
+        frame->m_chunk = callee;
+        chunk          = callee;
+        ip             = chunk->m_code;
+        sp             = base + chunk->m_frame_len;
+        break;
+      }
+
+      if (this->m_frames.size() >= this->m_max_frames)
+      {
+        UT_FAIL_MSG("Recursion limit exceeded (%zu frames) while calling (%s)",
+                    this->m_max_frames,
+                    UT_TCS(closure.m_proto->m_name));
+      }
+
+      size_t base_at      = args - stack;
+      size_t return_sp_at = return_sp - stack;
+      size_t len = base_at + callee->m_frame_len + callee->m_max_stack;
+      if (len > this->m_stack_len)
+      {
+        this->grow(len);
+        stack = this->m_stack;
+      }
+
+      frame->m_ip = ip;
+      this->m_frames.push_back(
+        CallFrame{ callee, callee->m_code, base_at, return_sp_at });
+
+      frame = &this->m_frames.back();
+      chunk = callee;
+      ip    = chunk->m_code;
+      base  = stack + base_at;
+      sp    = base + chunk->m_frame_len;
+    }
+    break;
+    case Op::CallForeign:
+    {
+      // NOTE: The resolver checked that the args fit, see check_foreign_args
+      ssize_t    words[TL::MAX_FOREIGN_ARGS];
+      RS::Value *args = sp - instr.m_argc;
+      size_t     argc = instr.m_argc;
+
+      for (size_t i = 0; i < argc; ++i)
+      {
+        switch (args[i].m_kind)
+        {
+        case RS::Kind::Int: words[i] = args[i].as.m_int; break;
+        case RS::Kind::Str: words[i] = (ssize_t)args[i].as.m_string.m_mem; break;
+        case RS::Kind::Fn:
+          UT_TODO("Functions can not be passed to C yet");
+          break;
+        }
+      }
+
+      ssize_t result
+        = TL::call_foreign(chunk->m_foreign[instr.m_arg], words, argc);
+      sp    = args;
+      *sp++ = RS::Value{ result };
+    }
+    break;
+    case Op::Return:
+    {
+      RS::Value  result    = sp[-1];
+      RS::Value *return_sp = stack + frame->m_return_sp;
+
+      this->m_frames.pop_back();
+      if (this->m_frames.empty()) return result;
+
+      frame = &this->m_frames.back();
+      chunk = frame->m_chunk;
+      ip    = frame->m_ip;
+      base  = stack + frame->m_base;
+      sp    = return_sp;
+      *sp++ = result;
+    }
+    break;
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------------
+ *\EOF
+ *------------------------------------------------------------------------------*/
+
+} // namespace VM
@@ -0,0 +1,55 @@
+#include "FF.hpp"
+#include "TL.hpp"
+#include "UT.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// NOTE: Runs the loop of ./dat/raylib.thr against the headless stand-in of
+// raylib for N frames on every engine, ie ./bin/bench_ffi 10000
+
+constexpr UT::String sut_file_raylib = "./dat/raylib.thr";
+constexpr UT::String raylib_path     = "./bin/raylib.so";
+constexpr UT::String stub_path       = "./bin/raylib_stub.so";
+
+int
+main(
+  int argc, char **argv)
+{
+  int frames = argc > 1 ? std::atoi(argv[1]) : 10000;
+
+  FF::Libraries::redirect(raylib_path, stub_path);
+  FF::Library *stub = FF::Libraries::open(stub_path);
+
+  auto set_frames  = (void (*)(int))FF::Libraries::find(stub, "StubSetFrames");
+  auto stub_calls  = (size_t (*)())FF::Libraries::find(stub, "StubCalls");
+  auto stub_frames = (size_t (*)())FF::Libraries::find(stub, "StubFrames");
+  UT_FAIL_IF(!set_frames || !stub_calls || !stub_frames);
+
+  for (TL::Engine engine :
+       { TL::Engine::Reference, TL::Engine::Frames, TL::Engine::VM })
+  {
+    set_frames(frames);
+
+    auto begin = std::chrono::steady_clock::now();
+    {
+      AR::Arena arena{};
+      TL::Mod   mod_raylib(sut_file_raylib, arena, TL::Options{ engine });
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // NOTE: The time of a call includes the script around it
+    double ns    = std::chrono::duration<double, std::nano>(end - begin).count();
+    size_t calls = stub_calls();
+    size_t done  = stub_frames();
+    std::printf("BENCH: %s %zu frames, %.0f frames/s, %zu C calls, %.1f ns "
+                "per C call\n",
+                UT_TCS(engine),
+                done,
+                done ? done / (ns / 1e9) : 0.0,
+                calls,
+                calls ? ns / calls : 0.0);
+  }
+
+  FF::Libraries::close(stub);
+}
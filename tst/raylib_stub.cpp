@@ -0,0 +1,163 @@
+#include <cstddef>
+
+// NOTE: Headless stand-in for the raylib fns of ./dat/raylib.thr, with the
+// signatures its ext defs give them. Nothing is drawn, every call is counted
+// and the window asks to close after the frames set with StubSetFrames.
+
+struct Rectangle
+{
+  float x;
+  float y;
+  float width;
+  float height;
+};
+
+struct Color
+{
+  unsigned char r;
+  unsigned char g;
+  unsigned char b;
+  unsigned char a;
+};
+
+static size_t frames_left = 0;
+static size_t frames_done = 0;
+static size_t calls       = 0;
+static size_t recs        = 0;
+
+extern "C" void
+StubSetFrames(
+  int frames)
+{
+  frames_left = frames > 0 ? frames : 0;
+  frames_done = 0;
+  calls       = 0;
+  recs        = 0;
+}
+
+extern "C" size_t
+StubCalls()
+{
+  return calls;
+}
+
+// NOTE: DrawRectangleRec calls whose structs came through whole
+extern "C" size_t
+StubRecs()
+{
+  return recs;
+}
+
+extern "C" size_t
+StubFrames()
+{
+  return frames_done;
+}
+
+extern "C" void
+SetTargetFPS(
+  int)
+{
+  calls += 1;
+}
+
+extern "C" void
+InitWindow(
+  int, int, const char *)
+{
+  calls += 1;
+}
+
+extern "C" int
+WindowShouldClose()
+{
+  calls += 1;
+  if (!frames_left) return 1;
+
+  frames_left -= 1;
+  return 0;
+}
+
+extern "C" void
+BeginDrawing()
+{
+  calls += 1;
+}
+
+extern "C" void
+EndDrawing()
+{
+  calls += 1;
+  frames_done += 1;
+}
+
+extern "C" void
+ClearBackground(
+  int)
+{
+  calls += 1;
+}
+
+extern "C" int
+GetRandomValue(
+  int min, int)
+{
+  calls += 1;
+  return min;
+}
+
+extern "C" void
+DrawRectangleLines(
+  int, int, int, int, int)
+{
+  calls += 1;
+}
+
+extern "C" int
+GetScreenHeight()
+{
+  calls += 1;
+  return 400;
+}
+
+extern "C" int
+GetScreenWidth()
+{
+  calls += 1;
+  return 400;
+}
+
+extern "C" void
+SetWindowState(
+  int)
+{
+  calls += 1;
+}
+
+extern "C" void
+SetConfigFlags(
+  int)
+{
+  calls += 1;
+}
+
+extern "C" void
+DrawRectangle(
+  int, int, int, int, int)
+{
+  calls += 1;
+}
+
+extern "C" void
+DrawRectangleRec(
+  Rectangle rec, Color color)
+{
+  calls += 1;
+  if (rec.width == rec.height && rec.width > 0 && 255 == color.a) recs += 1;
+}
+
+extern "C" void
+CloseWindow()
+{
+  calls += 1;
+}
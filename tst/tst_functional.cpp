@@ -1,8 +1,26 @@
+#include "FF.hpp"
 #include "TL.hpp"
 #include "UT.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 constexpr UT::String sut_file_basic  = "./dat/basic.thr";
+constexpr UT::String sut_file_deep   = "./dat/deep.thr";
+constexpr UT::String sut_file_ffi    = "./dat/ffi.thr";
+constexpr UT::String sut_file_alloc  = "./dat/alloc.thr";
+constexpr UT::String sut_file_buffer = "./dat/buffer.thr";
+constexpr UT::String sut_file_struct = "./dat/struct.thr";
+constexpr UT::String sut_file_cache  = "./dat/cache.thr";
+constexpr UT::String sut_file_async  = "./dat/async.thr";
+constexpr UT::String sut_file_defs   = "./dat/defs.thr";
 constexpr UT::String sut_file_raylib = "./dat/raylib.thr";
+constexpr UT::String sut_lib_raylib_stub = "./bin/raylib_stub.so";
 
 constexpr bool RUN_RAYLIB =
 #if GIT_ACTION_CTX
@@ -11,6 +29,230 @@ constexpr bool RUN_RAYLIB =
   true;
 #endif
 
+// NOTE: Counts the heap allocations of the whole process, alloc_count is
+// called from Thrax through the ext defs of sut_file_alloc
+static std::atomic<size_t> allocations{ 0 };
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t len, size_t size);
+extern "C" void *__libc_realloc(void *mem, size_t size);
+
+extern "C" void *
+malloc(
+  size_t size) noexcept
+{
+  allocations += 1;
+  return __libc_malloc(size);
+}
+
+extern "C" void *
+calloc(
+  size_t len, size_t size) noexcept
+{
+  allocations += 1;
+  return __libc_calloc(len, size);
+}
+
+extern "C" void *
+realloc(
+  void *mem, size_t size) noexcept
+{
+  allocations += 1;
+  return __libc_realloc(mem, size);
+}
+
+extern "C" int
+alloc_count(
+  int)
+{
+  return (int)allocations.load();
+}
+
+// NOTE: record is a batch ext def, recorded returns what it got and clears it
+static int records = 0;
+
+extern "C" void
+record(
+  int digit)
+{
+  records = records * 10 + digit;
+}
+
+extern "C" int
+recorded()
+{
+  int result = records;
+  records    = 0;
+  return result;
+}
+
+// NOTE: Work on the buffers of sut_file_buffer in place
+extern "C" void
+iota(
+  int *ints, int len)
+{
+  for (int i = 0; i < len; ++i) ints[i] = i + 1;
+}
+
+extern "C" int
+total(
+  const int *ints, int len)
+{
+  int sum = 0;
+  for (int i = 0; i < len; ++i) sum += ints[i];
+  return sum;
+}
+
+extern "C" int
+divide(
+  int dividend, int divisor, int *quotient)
+{
+  *quotient = dividend / divisor;
+  return dividend % divisor;
+}
+
+extern "C" void
+spell(
+  char *bytes, int len)
+{
+  for (int i = 0; i < len; ++i) bytes[i] = 'a' + i;
+}
+
+// NOTE: The cached ext defs of sut_file_cache count the calls that reach C
+static int width_calls  = 0;
+static int square_calls = 0;
+
+extern "C" int
+square(
+  int x)
+{
+  square_calls += 1;
+  return x * x;
+}
+
+extern "C" int
+width()
+{
+  width_calls += 1;
+  return 640;
+}
+
+extern "C" int
+calls()
+{
+  int result   = width_calls * 100 + square_calls;
+  width_calls  = 0;
+  square_calls = 0;
+  return result;
+}
+
+// NOTE: lower_flag waits for raise_flag, which the script calls after it, so
+// it only returns 1 if the script went on while it was running
+static std::mutex              flag_mutex;
+static std::condition_variable flag_raised;
+static bool                    flag = false;
+
+extern "C" int
+lower_flag()
+{
+  std::unique_lock<std::mutex> lock{ flag_mutex };
+  bool raised = flag_raised.wait_for(
+    lock, std::chrono::seconds(5), [] { return flag; });
+  flag = false;
+  return raised ? 1 : 0;
+}
+
+extern "C" void
+raise_flag()
+{
+  {
+    std::lock_guard<std::mutex> lock{ flag_mutex };
+    flag = true;
+  }
+  flag_raised.notify_all();
+}
+
+extern "C" int
+twice(
+  int x)
+{
+  return 2 * x;
+}
+
+// NOTE: The box of sut_file_struct, padded after each byte field
+struct Box
+{
+  int           x;
+  unsigned char tag;
+  float         width;
+  unsigned char height;
+};
+
+extern "C" int
+area(
+  Box box)
+{
+  return box.x + box.tag + (int)(box.width * box.height);
+}
+
+extern "C" Box
+grow(
+  Box box, int by)
+{
+  return Box{ box.x + by,
+              (unsigned char)(box.tag + by),
+              box.width * 2,
+              (unsigned char)(box.height + by) };
+}
+
+// NOTE: Takes more args than the thunks do, so it is called through libffi
+extern "C" int
+sum7(
+  int a, int b, int c, int d, int e, int f, int g)
+{
+  return a + b + c + d + e + f + g;
+}
+
+// NOTE: Reads file with each engine, fn checks the mod and the engine it ran on
+template <typename Fn>
+void
+for_each_engine(
+  UT::String file, Fn fn)
+{
+  for (TL::Engine engine :
+       { TL::Engine::Reference, TL::Engine::Frames, TL::Engine::VM })
+  {
+    AR::Arena arena{};
+    TL::Mod   mod(file, arena, TL::Options{ engine });
+    fn(engine, mod);
+  }
+}
+
+// NOTE: Fails unless def name of file is value with each engine
+void
+expect_int(
+  UT::String file, const char *name, ssize_t value)
+{
+  for_each_engine(file, [&](TL::Engine engine, TL::Mod &mod) {
+    TL::Def *def = nullptr;
+    for (TL::Def &candidate : mod.m_defs)
+    {
+      if (name == candidate.m_name) def = &candidate;
+    }
+    if (!def) UT_FAIL_MSG("No def (%s) in %s", name, UT_TCS(file));
+
+    if (EX::Type::Int != def->m_expr.m_type || value != def->m_expr.as.m_int)
+    {
+      UT_FAIL_MSG("(%s) of %s with %s gave %s != %zd",
+                  name,
+                  UT_TCS(file),
+                  UT_TCS(engine),
+                  UT_TCS(def->m_expr),
+                  value);
+    }
+  });
+}
+
 int
 main()
 {
@@ -18,6 +260,260 @@ main()
   {
     AR::Arena arena{};
     TL::Mod   mod_basic(sut_file_basic, arena);
+    TL::Mod   mod_reference(
+      sut_file_basic,
+      arena,
+      TL::Options{ TL::Engine::Reference, false, 0, false });
+    TL::Mod mod_vm(sut_file_basic, arena, TL::Options{ TL::Engine::VM });
+    TL::Mod mod_jit(
+      sut_file_basic, arena, TL::Options{ TL::Engine::Reference, true });
+    TL::Mod mod_memo(
+      sut_file_basic, arena, TL::Options{ TL::Engine::Frames, true, 16 });
+    TL::Mod mod_memo_reference(
+      sut_file_basic, arena, TL::Options{ TL::Engine::Reference, false, 16 });
+
+    TL::Options parallel{ TL::Engine::Frames };
+    parallel.m_workers = 4;
+    TL::Mod mod_parallel(sut_file_basic, arena, parallel);
+
+    parallel.m_engine = TL::Engine::VM;
+    TL::Mod mod_parallel_vm(sut_file_basic, arena, parallel);
+
+    TL::Options forked{ TL::Engine::Reference, false };
+    forked.m_workers    = 4;
+    forked.m_fork_depth = 4;
+    TL::Mod mod_forked(sut_file_basic, arena, forked);
+
+    for (size_t i = 0; i < mod_basic.m_defs.m_len; ++i)
+    {
+      std::string frames    = std::to_string(mod_basic.m_defs[i].m_expr);
+      std::string vm        = std::to_string(mod_vm.m_defs[i].m_expr);
+      std::string jit       = std::to_string(mod_jit.m_defs[i].m_expr);
+      std::string memo      = std::to_string(mod_memo.m_defs[i].m_expr);
+      std::string reference = std::to_string(mod_reference.m_defs[i].m_expr);
+      std::string memo_reference
+        = std::to_string(mod_memo_reference.m_defs[i].m_expr);
+      std::string parallel = std::to_string(mod_parallel.m_defs[i].m_expr);
+      std::string parallel_vm
+        = std::to_string(mod_parallel_vm.m_defs[i].m_expr);
+      std::string forked = std::to_string(mod_forked.m_defs[i].m_expr);
+      if (frames != reference || vm != reference || jit != reference
+          || memo != reference || memo_reference != reference
+          || parallel != reference || parallel_vm != reference
+          || forked != reference)
+      {
+        UT_FAIL_MSG(
+          "Engines disagree on (%s): %s, %s, %s, %s, %s, %s, %s, %s != %s",
+          UT_TCS(mod_basic.m_defs[i].m_name),
+          frames.c_str(),
+          vm.c_str(),
+          jit.c_str(),
+          memo.c_str(),
+          memo_reference.c_str(),
+          parallel.c_str(),
+          parallel_vm.c_str(),
+          forked.c_str(),
+          reference.c_str());
+      }
+    }
+
+    size_t folded = 0;
+    for (TL::Def &def : mod_basic.m_defs) folded += def.m_folded;
+    if (!folded) UT_FAIL_MSG("No node of %s was folded", UT_TCS(sut_file_basic));
+
+    if (!mod_memo.m_memo.m_hits || !mod_memo_reference.m_memo.m_hits)
+    {
+      UT_FAIL_MSG("Pure defs were not memoized: %s, %s",
+                  UT_TCS(mod_memo.m_memo),
+                  UT_TCS(mod_memo_reference.m_memo));
+    }
+  }
+
+  {
+    AR::Arena arena{};
+    TL::Mod   mod_deep(sut_file_deep, arena, TL::Options{ TL::Engine::VM });
+
+    TL::Def &sum_deep = *mod_deep.m_defs.last();
+    if (EX::Type::Int != sum_deep.m_expr.m_type
+        || 500000500000 != sum_deep.m_expr.as.m_int)
+    {
+      UT_FAIL_MSG("Deep recursion gave %s", UT_TCS(sum_deep.m_expr));
+    }
+  }
+
+  {
+    // NOTE: Keywords in comments and strings do not begin defs
+    AR::Arena arena{};
+    TL::Mod   mod_defs(sut_file_defs, arena);
+
+    TL::Def &defs = *mod_defs.m_defs.last();
+    if (3 != mod_defs.m_defs.m_len || EX::Type::Int != defs.m_expr.m_type
+        || 42 != defs.m_expr.as.m_int)
+    {
+      UT_FAIL_MSG("Defs gave %zu defs and %s",
+                  mod_defs.m_defs.m_len,
+                  UT_TCS(defs.m_expr));
+    }
+  }
+
+  {
+    // NOTE: Words that were seen before and strings take no heap allocation of
+    // their own, only the blocks of the arena are allocated
+    std::string source{};
+    for (size_t i = 0; i < 256; ++i) source += "\"a string\" word ";
+
+    AR::Arena arena{};
+    LX::Lexer seen{ source.c_str(), arena, 0, source.size() };
+    seen.run();
+
+    size_t    before        = allocations.load();
+    size_t    blocks_before = arena.blocks();
+    LX::Lexer lexer{ source.c_str(), arena, 0, source.size() };
+    lexer.run();
+    size_t lexed        = allocations.load() - before;
+    size_t blocks_after = arena.blocks();
+
+    // NOTE: The list of blocks doubles from DEFAULT_T_MEM_SIZE when it is full
+    size_t grown = blocks_after - blocks_before;
+    for (size_t len = AR::DEFAULT_T_MEM_SIZE; len < blocks_after; len *= 2)
+    {
+      if (len >= blocks_before) grown += 1;
+    }
+
+    if (512 != lexer.m_tokens.m_len || lexed != grown)
+    {
+      UT_FAIL_MSG("Lexing %zu tokens allocated %zu times, the arena %zu times",
+                  lexer.m_tokens.m_len,
+                  lexed,
+                  grown);
+    }
+  }
+
+  {
+    // NOTE: Every scan kernel the CPU has stops where the scalar one does, on
+    // random runs that begin at every alignment, some of them end at the NUL
+    // and the bytes past it are not NUL
+    constexpr char   BYTES[] = " \t\n\"#(+:aZ0_\x7f\x80\xff";
+    constexpr size_t LEN     = 96;
+    alignas(32) char input[LEN + 64];
+    std::mt19937     random{ 24 };
+
+    for (size_t round = 0; round < 64; ++round)
+    {
+      char byte = BYTES[0];
+      for (size_t i = 0; i < sizeof(input); ++i)
+      {
+        if (0 == random() % 6) byte = BYTES[random() % (sizeof(BYTES) - 1)];
+        input[i] = byte;
+      }
+      size_t end = 32 + random() % LEN;
+      input[end] = '\0';
+
+      for (size_t idx = 0; idx <= end; ++idx)
+      {
+        for (LX::Scan scan : { LX::Scan::WhiteSpace,
+                               LX::Scan::Word,
+                               LX::Scan::Name,
+                               LX::Scan::Line,
+                               LX::Scan::Quote })
+        {
+          size_t expected
+            = LX::scan_with(LX::ScanKernel::Scalar, scan, input, idx);
+          for (LX::ScanKernel kernel :
+               { LX::ScanKernel::SSSE3, LX::ScanKernel::AVX2 })
+          {
+            if (!LX::has_scan_kernel(kernel)) continue;
+
+            size_t found = LX::scan_with(kernel, scan, input, idx);
+            if (expected != found)
+            {
+              UT_FAIL_MSG("Scan %d from %zu stopped at %zu with kernel %d, "
+                          "not at %zu",
+                          (int)scan,
+                          idx,
+                          found,
+                          (int)kernel,
+                          expected);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  expect_int(sut_file_ffi, "sum", 78);
+  // NOTE: The batched calls are made in order before the next C call
+  expect_int(sut_file_ffi, "records", 123);
+  // NOTE: 5050 + 7 + 9 + 2 + 3, each part was written by C or read by C
+  expect_int(sut_file_buffer, "buffers", 5071);
+  // NOTE: 238 + 285 + 10, the boxes went to C and came back by value
+  expect_int(sut_file_struct, "structs", 533);
+  // NOTE: 1 + 40 + 40, a handle can be waited on more than once
+  expect_int(sut_file_async, "awaited", 81);
+
+  // NOTE: width reaches C once for each of the 5 frames, square once for
+  // each of its 2 args, the other 18 calls hit
+  expect_int(sut_file_cache, "cached", 502);
+  for_each_engine(sut_file_cache, [](TL::Engine engine, TL::Mod &mod) {
+    if (18 != mod.m_ext_cache.m_hits)
+    {
+      UT_FAIL_MSG(
+        "Ext cache of %s gave %s", UT_TCS(engine), UT_TCS(mod.m_ext_cache));
+    }
+  });
+
+  {
+    // NOTE: Every module that uses a library shares one handle of it
+    FF::Library *first  = FF::Libraries::open("");
+    FF::Library *second = FF::Libraries::open("");
+    UT_FAIL_IF(first != second || !FF::Libraries::find(second, "sum7"));
+    FF::Libraries::close(first);
+    FF::Libraries::close(second);
+  }
+
+  expect_int(sut_file_alloc, "allocs", 0);
+  // NOTE: Makes its calls with locals in scope, in a loop
+  expect_int(sut_file_alloc, "scoped_allocs", 0);
+  // NOTE: Returns a struct every time around the loop
+  expect_int(sut_file_alloc, "struct_allocs", 0);
+
+  {
+    // NOTE: Going past the limit has to fail with an error, not a segfault
+    int out[2];
+    UT_FAIL_IF(pipe(out));
+
+    pid_t pid = fork();
+    if (0 == pid)
+    {
+      dup2(out[1], STDOUT_FILENO);
+
+      rlimit no_core{ 0, 0 };
+      setrlimit(RLIMIT_CORE, &no_core);
+
+      TL::Options options{ TL::Engine::VM };
+      options.m_max_frames = 1000;
+
+      AR::Arena arena{};
+      TL::Mod   mod_deep(sut_file_deep, arena, options);
+      std::exit(0);
+    }
+    close(out[1]);
+
+    std::string output{};
+    char        buffer[256];
+    for (ssize_t len = 0; (len = read(out[0], buffer, sizeof(buffer))) > 0;)
+    {
+      output.append(buffer, len);
+    }
+    close(out[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFSIGNALED(status) || SIGSEGV == WTERMSIG(status)
+        || std::string::npos == output.find("Recursion limit exceeded"))
+    {
+      UT_FAIL_MSG("Recursion limit was not reported: %s", output.c_str());
+    }
   }
 
   if (RUN_RAYLIB)
@@ -25,4 +521,28 @@ main()
     AR::Arena arena{};
     TL::Mod   mod_raylib(sut_file_raylib, arena);
   }
+
+  {
+    // NOTE: The demo runs headless against the stand-in of raylib from here on
+    FF::Libraries::redirect("./bin/raylib.so", sut_lib_raylib_stub);
+    FF::Library *stub = FF::Libraries::open(sut_lib_raylib_stub);
+
+    auto set_frames  = (void (*)(int))FF::Libraries::find(stub, "StubSetFrames");
+    auto stub_frames = (size_t (*)())FF::Libraries::find(stub, "StubFrames");
+    auto stub_recs   = (size_t (*)())FF::Libraries::find(stub, "StubRecs");
+    UT_FAIL_IF(!set_frames || !stub_frames || !stub_recs);
+
+    set_frames(60);
+    {
+      AR::Arena arena{};
+      TL::Mod   mod_raylib(sut_file_raylib, arena);
+    }
+    if (60 != stub_frames() || 60 != stub_recs())
+    {
+      UT_FAIL_MSG("The headless demo drew %zu frames and %zu structs",
+                  stub_frames(),
+                  stub_recs());
+    }
+    FF::Libraries::close(stub);
+  }
 }
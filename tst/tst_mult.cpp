@@ -1,8 +1,17 @@
 #include "EX.hpp"
 #include "LX.hpp"
+#include "MM.hpp"
+#include "OP.hpp"
+#include "RS.hpp"
 #include "TL.hpp"
 #include "UT.hpp"
+#include "VM.hpp"
 #include <cstdio>
+#include <pthread.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <utility>
 
 #define TSTxCTL 0
@@ -82,6 +91,16 @@ constexpr INPUTS_t INPUTS[] = {
 #endif
 
 };
+
+// NOTE: Bodies of lets, ifs, whiles and fns inside of parens, the ')' after
+// each of them closes a group of the lexer that the body is lexed in
+constexpr INPUTS_t SCOPED_INPUTS[] = {
+  { "(let x = 2 in x * 3) + 1", 7 },
+  { "1 + (if 1 ?= 1 => 2 else 3) * 5", 11 },
+  { "(let i = 0 in (while !(i ?= 3) => let i = i + 1 in i)) + 4", 4 },
+  { "((\\x = x * x) 7) - 9", 40 },
+  { "((let x = 1 in (let y = x + 1 in (if y ?= 2 => y else 0))) + 1)", 3 },
+};
 } // namespace TDATA
 
 namespace
@@ -89,9 +108,13 @@ namespace
 bool
 run()
 {
-  for (size_t i = 0; i < ARRAY_LEN(TDATA::INPUTS); ++i)
+  constexpr size_t INPUTS_LEN = ARRAY_LEN(TDATA::INPUTS);
+  for (size_t i = 0; i < INPUTS_LEN + ARRAY_LEN(TDATA::SCOPED_INPUTS); ++i)
   {
-    auto        tdata = TDATA::INPUTS[i];
+    // NOTE: The folder leaves lets alone, so only INPUTS fold to an int
+    bool foldable = i < INPUTS_LEN;
+    auto tdata
+      = foldable ? TDATA::INPUTS[i] : TDATA::SCOPED_INPUTS[i - INPUTS_LEN];
     AR::Arena   arena{};
     const char *input = tdata.first;
     LX::Lexer   l{ input, arena, 0, std::strlen(input) };
@@ -113,7 +136,211 @@ run()
                     i);
       }
     }
+
+    RS::Value frames_result = RS::eval(*parser.m_exprs.begin(), arena);
+    if (RS::Kind::Int != frames_result.m_kind
+        || tdata.second != frames_result.as.m_int)
+    {
+      UT_FAIL_MSG("Expected %s but the frame runtime found %s, expression "
+                  "number %zu",
+                  UT_TCS(tdata.second),
+                  UT_TCS(frames_result),
+                  i);
+    }
+
+    if (!foldable) continue;
+
+    OP::Folder folder{};
+    EX::Expr   folded = *parser.m_exprs.begin();
+    (void)folder.run("", folded);
+    if (EX::Type::Int != folded.m_type || tdata.second != folded.as.m_int)
+    {
+      UT_FAIL_MSG("Expected %s but folding found %s, expression number %zu",
+                  UT_TCS(tdata.second),
+                  UT_TCS(folded),
+                  i);
+    }
+  }
+
+  return true;
+}
+
+// NOTE: Groups are lexed without recursion, so nesting is only limited by the
+// passes after the lexer
+bool
+run_nested()
+{
+  constexpr size_t DEPTH = 16000;
+
+  std::string input{};
+  for (size_t i = 0; i < DEPTH; ++i) input += "(1 + ";
+  input += "1";
+  for (size_t i = 0; i < DEPTH; ++i) input += ")";
+
+  AR::Arena arena{};
+  LX::Lexer lexer{ input.c_str(), arena, 0, input.size() };
+  LX::E     e = lexer.run();
+
+  size_t    depth = 0;
+  LX::Token group = lexer.m_tokens[0];
+  while (LX::Type::Group == group.type)
+  {
+    depth += 1;
+    group = group.as.tokens[group.as.tokens.m_len - 1];
+  }
+  if (LX::E::OK != e || 1 != lexer.m_tokens.m_len || DEPTH != depth)
+  {
+    UT_FAIL_MSG("Nesting %zu deep lexed to %s with %zu groups",
+                DEPTH,
+                UT_TCS(e),
+                depth);
+  }
+  return true;
+}
+
+// NOTE: Small enough that every pass runs out of it well before the nesting
+// below ends, so the tests do not depend on the size of the main stack
+constexpr size_t DEEP_STACK_LEN = 1 << 19;
+constexpr size_t DEEP_NESTING   = 1 << 16;
+
+// NOTE: Runs check on a thread with a small stack in a child process, which
+// has to fail with the recursion limit error instead of a segfault
+template <typename Check>
+void
+expect_recursion_limit(
+  const char *pass, Check check)
+{
+  int out[2];
+  UT_FAIL_IF(pipe(out));
+  std::fflush(stdout);
+
+  pid_t pid = fork();
+  if (0 == pid)
+  {
+    dup2(out[1], STDOUT_FILENO);
+
+    rlimit no_core{ 0, 0 };
+    setrlimit(RLIMIT_CORE, &no_core);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, DEEP_STACK_LEN);
+
+    pthread_t thread;
+    pthread_create(
+      &thread,
+      &attr,
+      [](void *arg) -> void * {
+        (*(Check *)arg)();
+        return nullptr;
+      },
+      &check);
+    pthread_join(thread, nullptr);
+    std::exit(0);
+  }
+  close(out[1]);
+
+  std::string output{};
+  char        buffer[256];
+  for (ssize_t len = 0; (len = read(out[0], buffer, sizeof(buffer))) > 0;)
+  {
+    output.append(buffer, len);
+  }
+  close(out[0]);
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (!WIFSIGNALED(status) || SIGSEGV == WTERMSIG(status)
+      || std::string::npos == output.find("Recursion limit exceeded"))
+  {
+    UT_FAIL_MSG("Recursion limit was not reported by %s: %s",
+                pass,
+                output.c_str());
+  }
+}
+
+// NOTE: 1 + (1 + (1 + ...)) built without the parser, which would run out of
+// stack first
+EX::Expr
+nested_sum(
+  AR::Arena &arena, size_t depth)
+{
+  EX::Expr one{ EX::Type::Int };
+  one.as.m_int = 1;
+
+  EX::Expr sum = one;
+  for (size_t i = 0; i < depth; ++i)
+  {
+    EX::Expr add{ EX::Type::Add, arena };
+    *add.as.m_pair.begin() = one;
+    *add.as.m_pair.last()  = sum;
+    sum                    = add;
   }
+  return sum;
+}
+
+bool
+run_deep()
+{
+  expect_recursion_limit("the parser", [] {
+    std::string input{};
+    for (size_t i = 0; i < DEEP_NESTING; ++i) input += "(1 + ";
+    input += "1";
+    for (size_t i = 0; i < DEEP_NESTING; ++i) input += ")";
+
+    AR::Arena  arena{};
+    LX::Lexer  lexer{ input.c_str(), arena, 0, input.size() };
+    (void)lexer.run();
+    EX::Parser parser{ lexer };
+    parser.run();
+  });
+
+  expect_recursion_limit("the reference engine", [] {
+    AR::Arena    arena{};
+    TL::Instance instance{ nested_sum(arena, DEEP_NESTING), TL::Env{} };
+    (void)TL::eval(instance);
+  });
+
+  expect_recursion_limit("the resolver", [] {
+    AR::Arena arena{};
+    (void)RS::eval(nested_sum(arena, DEEP_NESTING), arena);
+  });
+
+  expect_recursion_limit("the folder", [] {
+    AR::Arena  arena{};
+    OP::Folder folder{};
+    EX::Expr   sum = nested_sum(arena, DEEP_NESTING);
+    (void)folder.run("", sum);
+  });
+
+  expect_recursion_limit("count_nodes", [] {
+    AR::Arena arena{};
+    (void)OP::count_nodes(nested_sum(arena, DEEP_NESTING));
+  });
+
+  expect_recursion_limit("the purity analysis", [] {
+    AR::Arena  arena{};
+    MM::Purity purity{};
+    (void)purity.analyse("deep", nested_sum(arena, DEEP_NESTING));
+  });
+
+  expect_recursion_limit("the VM compiler", [] {
+    AR::Arena arena{};
+    RS::Node *sum = (RS::Node *)arena.alloc<RS::Node>();
+    new (sum) RS::Node{ RS::Op::Int };
+    for (size_t i = 0; i < DEEP_NESTING; ++i)
+    {
+      RS::Node *add = (RS::Node *)arena.alloc<RS::Node>();
+      new (add) RS::Node{ RS::Op::Add };
+      add->as.m_bin = RS::BinOp{ sum, sum };
+      sum           = add;
+    }
+
+    RS::Proto proto{};
+    proto.m_body = sum;
+    VM::Compiler compiler{ arena };
+    (void)compiler.compile(proto);
+  });
 
   return true;
 }
@@ -122,7 +349,7 @@ run()
 int
 main()
 {
-  if (!run())
+  if (!run() || !run_nested() || !run_deep())
   {
     std::printf("%s [OK]\n", __FILE_NAME__);
     return 1;